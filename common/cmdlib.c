@@ -16,6 +16,10 @@ last modified:
 =================
 */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		/* copy_file_range */
+#endif
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -30,6 +34,21 @@ last modified:
 
 #ifdef WIN32
 #include <direct.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
 #endif
 
 #ifdef NeXT
@@ -302,7 +321,7 @@ void Q_getwd (char *out)
    _getcwd (out, 256);
    strcat (out, "\\");
 #else
-   getcwd (out);
+   getcwd (out, 256);
 #endif
 }
 
@@ -837,6 +856,39 @@ float	BigFloat (float l)
 }
 
 
+void	BigShortArray (short *data, int count)
+{
+	(void)data;
+	(void)count;
+}
+
+void	LittleShortArray (short *data, int count)
+{
+	SwapArray16 (data, count);
+}
+
+void	BigLongArray (int *data, int count)
+{
+	(void)data;
+	(void)count;
+}
+
+void	LittleLongArray (int *data, int count)
+{
+	SwapArray32 (data, count);
+}
+
+void	BigFloatArray (float *data, int count)
+{
+	(void)data;
+	(void)count;
+}
+
+void	LittleFloatArray (float *data, int count)
+{
+	SwapArray32 (data, count);
+}
+
 #else
 
 
@@ -891,9 +943,109 @@ float	LittleFloat (float l)
 	return l;
 }
 
+void	BigShortArray (short *data, int count)
+{
+	SwapArray16 (data, count);
+}
+
+void	LittleShortArray (short *data, int count)
+{
+	(void)data;
+	(void)count;
+}
+
+void	BigLongArray (int *data, int count)
+{
+	SwapArray32 (data, count);
+}
+
+void	LittleLongArray (int *data, int count)
+{
+	(void)data;
+	(void)count;
+}
+
+void	BigFloatArray (float *data, int count)
+{
+	SwapArray32 (data, count);
+}
+
+void	LittleFloatArray (float *data, int count)
+{
+	(void)data;
+	(void)count;
+}
+
 
 #endif
 
+/*
+============
+SwapArray
+
+  Reverses the bytes of count elements of size 2, 4 or 8 in place,
+  32 or 16 bytes per instruction where the compiler targets AVX2 or
+  SSSE3 (-mavx2, -mssse3, /arch:AVX2), the rest one at a time. The
+  data needn't be aligned.
+============
+*/
+static void SwapArray (byte *data, int count, int size)
+{
+	byte	*end, t;
+	int		i;
+#if defined(__AVX2__) || defined(__SSSE3__)
+	byte	order[32];
+
+	/* shuffle indices are taken per 16 byte lane, modulo 16 */
+	for (i=0 ; i<32 ; i++)
+		order[i] = (i/size)*size + size-1 - i%size;
+#endif
+
+	end = data + count*size;
+
+#if defined(__AVX2__)
+	{
+		__m256i	mask = _mm256_loadu_si256 ((__m256i *)order);
+
+		for ( ; data + 32 <= end ; data += 32)
+			_mm256_storeu_si256 ((__m256i *)data,
+				_mm256_shuffle_epi8 (_mm256_loadu_si256 ((__m256i *)data), mask));
+	}
+#endif
+#if defined(__AVX2__) || defined(__SSSE3__)
+	{
+		__m128i	mask = _mm_loadu_si128 ((__m128i *)order);
+
+		for ( ; data + 16 <= end ; data += 16)
+			_mm_storeu_si128 ((__m128i *)data,
+				_mm_shuffle_epi8 (_mm_loadu_si128 ((__m128i *)data), mask));
+	}
+#endif
+
+	for ( ; data < end ; data += size)
+		for (i=0 ; i<size/2 ; i++)
+		{
+			t = data[i];
+			data[i] = data[size-1-i];
+			data[size-1-i] = t;
+		}
+}
+
+void	SwapArray16 (void *data, int count)
+{
+	SwapArray (data, count, 2);
+}
+
+void	SwapArray32 (void *data, int count)
+{
+	SwapArray (data, count, 4);
+}
+
+void	SwapArray64 (void *data, int count)
+{
+	SwapArray (data, count, 8);
+}
+
 /*
 //=======================================================
 
@@ -989,18 +1141,168 @@ void	CreatePath (char *path)
 ============
 QCopyFile
 
-  Used to archive source files
+  Used to archive source files. The data doesn't come up to user
+  space where the kernel can copy it: copy_file_range, which may
+  share or clone the blocks, then sendfile, then COPY_CHUNK bytes
+  at a time through a buffer.
 ============
 */
+#define	COPY_CHUNK	0x10000
+
+#ifdef WIN32
+
 void QCopyFile (char *from, char *to)
 {
-	void	*buffer;
-	int		length;
+	CreatePath (to);
+	if (!CopyFileA (from, to, FALSE))
+		Error ("Error copying %s to %s: %lu", from, to, GetLastError ());
+}
+
+#else
+
+static void QCopyBuffered (int in, int out, char *from, char *to)
+{
+	char	buffer[COPY_CHUNK];
+	ssize_t	length, written, n;
+
+	while ((length = read (in, buffer, sizeof(buffer))) != 0)
+	{
+		if (length < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			Error ("Error reading %s: %s", from, strerror(errno));
+		}
+		for (written = 0 ; written < length ; written += n)
+		{
+			n = write (out, buffer + written, length - written);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+				{
+					n = 0;
+					continue;
+				}
+				Error ("Error writing %s: %s", to, strerror(errno));
+			}
+		}
+	}
+}
+
+void QCopyFile (char *from, char *to)
+{
+	int		in, out;
+	struct stat	st;
+	off_t	left;
+	ssize_t	n;
+
+	in = open (from, O_RDONLY);
+	if (in < 0 || fstat (in, &st) < 0)
+		Error ("Error opening %s: %s", from, strerror(errno));
 
-	length = LoadFile (from, &buffer);
 	CreatePath (to);
-	SaveFile (to, buffer, length);
-	free (buffer);
+	out = open (to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out < 0)
+		Error ("Error opening %s: %s", to, strerror(errno));
+
+	left = st.st_size;
+#ifdef __linux__
+	/* both need the file offsets untouched if they fail before copying anything */
+	while (left > 0 && (n = copy_file_range (in, NULL, out, NULL, left, 0)) > 0)
+		left -= n;
+	if (left > 0 && left == st.st_size)
+		while (left > 0 && (n = sendfile (out, in, NULL, left)) > 0)
+			left -= n;
+#endif
+	/* whatever is left, and anything appended since the fstat */
+	QCopyBuffered (in, out, from, to);
+
+	close (in);
+	if (close (out) < 0)
+		Error ("Error writing %s: %s", to, strerror(errno));
+}
+
+#endif
+
+/*
+============
+QCopyFiles
+
+  Copies from[i] to to[i] on up to COPY_THREADS threads of its own,
+  independent of RunThreadsOn, and returns when all are done
+============
+*/
+#define	COPY_THREADS	4
+
+typedef struct
+{
+	int		first;
+	int		stride;
+	int		count;
+	char	**from;
+	char	**to;
+} copyjob_t;
+
+#ifdef WIN32
+static DWORD WINAPI QCopyThread (LPVOID arg)
+#else
+static void *QCopyThread (void *arg)
+#endif
+{
+	copyjob_t	*job = arg;
+	int			i;
+
+	for (i = job->first ; i < job->count ; i += job->stride)
+		QCopyFile (job->from[i], job->to[i]);
+	return 0;
+}
+
+void QCopyFiles (int count, char **from, char **to)
+{
+	copyjob_t	jobs[COPY_THREADS];
+	int			i, threads;
+#ifdef WIN32
+	HANDLE		handles[COPY_THREADS];
+	DWORD		id;
+#else
+	pthread_t	handles[COPY_THREADS];
+#endif
+
+	threads = count < COPY_THREADS ? count : COPY_THREADS;
+	for (i=0 ; i<threads ; i++)
+	{
+		jobs[i].first = i;
+		jobs[i].stride = threads;
+		jobs[i].count = count;
+		jobs[i].from = from;
+		jobs[i].to = to;
+	}
+
+	/* the first share is done on this thread */
+	for (i=1 ; i<threads ; i++)
+	{
+#ifdef WIN32
+		handles[i] = CreateThread (NULL, 0, QCopyThread, &jobs[i], 0, &id);
+		if (!handles[i])
+			Error ("CreateThread failed");
+#else
+		if (pthread_create (&handles[i], NULL, QCopyThread, &jobs[i]))
+			Error ("pthread_create failed");
+#endif
+	}
+
+	if (threads)
+		QCopyThread (&jobs[0]);
+
+	for (i=1 ; i<threads ; i++)
+	{
+#ifdef WIN32
+		WaitForSingleObject (handles[i], INFINITE);
+		CloseHandle (handles[i]);
+#else
+		pthread_join (handles[i], NULL);
+#endif
+	}
 }
 
 
@@ -1021,6 +1323,7 @@ void ListPak(char* pakname)
 	long totlen=0;
 
 	SafeRead(f,&head,sizeof(packheader_t));
+	LittleLongArray(&head.dirofs,2);
 	pdir=malloc(head.dirlen);
 
 	fseek(f,head.dirofs,SEEK_SET);
@@ -1035,6 +1338,7 @@ void ListPak(char* pakname)
 
 	for(i;i<imax;i++)
 	{
+		LittleLongArray(&pdir[i].filepos,2);
 		printf ("%64s : %7i\n", pdir[i].name,pdir[i].filelen);
 	}
 
@@ -103,6 +103,17 @@ int		LittleLong (int l);
 float	BigFloat (float l);
 float	LittleFloat (float l);
 
+/* in place, count elements */
+void	SwapArray16 (void *data, int count);
+void	SwapArray32 (void *data, int count);
+void	SwapArray64 (void *data, int count);
+void	BigShortArray (short *data, int count);
+void	LittleShortArray (short *data, int count);
+void	BigLongArray (int *data, int count);
+void	LittleLongArray (int *data, int count);
+void	BigFloatArray (float *data, int count);
+void	LittleFloatArray (float *data, int count);
+
 long flen(FILE* f);
 
 
@@ -121,6 +132,7 @@ unsigned short CRC_Value(unsigned short crcvalue);
 
 void	CreatePath (char *path);
 void	QCopyFile (char *from, char *to);
+void	QCopyFiles (int count, char **from, char **to);
 
 extern	qboolean		archive;
 extern	char			archivedir[1024];
@@ -25,6 +25,25 @@ extern "C"
 {
 #endif
 
+/*
+
+stroke record structure (4 bytes, a packet carries MAX_MSG_LENGTH/4 of them)
+|x0|y0|x1|y1|                   line, coordinates 0..254
+|255|op|seq_hi|seq_lo|          operation on line sequence number seq
+|255|255|255|255|               clear, restarts sequence numbers at 0
+
+*/
+
+#define STROKE_ESCAPE       255
+#define STROKE_OP_NOP       0   /* ignored, fills link probe packets */
+#define STROKE_OP_BASE      1   /* next line in this packet has number seq */
+#define STROKE_OP_UNDO      2   /* hide line seq */
+#define STROKE_OP_REDO      3   /* show line seq again */
+#define STROKE_OP_ERASE     4   /* remove line seq for good */
+#define STROKE_OP_CLEAR     255
+
+#define STROKE_RECORDS      (MAX_MSG_LENGTH / 4)
+
 typedef struct
 {
     unsigned char x0;
@@ -33,11 +52,19 @@ typedef struct
     unsigned char y1;
 } line_t;
 
+typedef struct
+{
+    line_t line;
+    unsigned short seq;     /* sequence number on the wire */
+    unsigned char sent;     /* already handed to the server */
+} seqline_t;
+
 #ifdef __cplusplus
 }
 #endif
 
 typedef std::vector<line_t> drawlines_t;
+typedef std::vector<seqline_t> seqlines_t;
 
 
 #endif // INCLUDED_CMDLINE
@@ -26,6 +26,7 @@
 
 #include "CmdLine.h"
 #include "shared.h"
+#include "probes.h"
 #include "server.h"
 #include "client.h"
 
@@ -38,6 +39,7 @@ extern "C"
     namespace {
 #endif
 extern void delay(unsigned int howLong);
+extern unsigned int millis(void);
 #ifdef __cplusplus
     } //namespace
 }
@@ -52,6 +54,22 @@ extern char g_appTitle[];
 
 GlWindow *g_GlWindow = 0;
 
+// receiver line slot state
+#define LINE_PRESENT    1
+#define LINE_HIDDEN     2
+#define LINE_ERASED     4
+
+// maps a window position to a stroke coordinate, 255 is reserved for STROKE_ESCAPE
+static unsigned char ToCoord( int pos, int size )
+{
+    int v = size > 0 ? int( pos * 255.0f / size ) : 0;
+    if( v < 0 )
+        v = 0;
+    if( v > 254 )
+        v = 254;
+    return (unsigned char)v;
+}
+
 GlWindow :: GlWindow( mxWindow *parent, int x, int y, int w, int h, const char *label, int style ) : mxGlWindow( parent, x, y, w, h, label, style )
 {
 //	glDepthFunc( GL_LEQUAL );
@@ -65,12 +83,16 @@ GlWindow :: GlWindow( mxWindow *parent, int x, int y, int w, int h, const char *
 	    y0 = 0;
 	    x1 = 0;
 	    y1 = 0;
+	    BufferStart = 0;
+	    NextSeq = 0;
+	    RecvSeq = 0;
+	    Erasing = false;
 //    PrevLine.x0 = 0;
 //    PrevLine.y0 = 0;
 //    PrevLine.x1 = 0;
 //    PrevLine.y1 = 0;
 
-    setTimer( BAUD_RATE * 10 );
+    setTimer( COALESCE_DELAY / 2 );
 }
 
 GlWindow :: ~GlWindow( void )
@@ -121,73 +143,18 @@ int GlWindow :: handleEvent( mxEvent *event )
 
             if(this->isEnabled())
             {
-                if(Buffer.size() < MAX_MSG_LENGTH/4)
-                    {
-                    unsigned char msg[MAX_MSG_LENGTH + 1];
-                    msg[MAX_MSG_LENGTH] = '\0';
-                    int i = 0;
-
-                    msg[MAX_MSG_LENGTH] = '\0';
-
-                    for(drawlines_t::iterator iter_buffer = Buffer.begin(); iter_buffer != Buffer.end() && i < MAX_MSG_LENGTH; ++iter_buffer, i+=4)
-                    {
-                    msg[i] = iter_buffer->x0;
-                    msg[i+1] = iter_buffer->y0;
-                    msg[i+2] = iter_buffer->x1;
-                    msg[i+3] = iter_buffer->y1;
-                    }
-
-                    msg[i] = '\0';
-
-                    if(Buffer.size() == MAX_MSG_LENGTH/4)
-                    {
-                        SV_insert_msg(msg);
-                        Buffer.clear();
-                    }
-                    else
-                        if(!SV_insert_msg_nb(msg))
-                            Buffer.clear();
-                }
-                else if(Buffer.size() > MAX_MSG_LENGTH/4)
-                        Buffer.clear();
+                if(!Buffer.empty() && millis() - BufferStart >= COALESCE_DELAY)
+                    FlushBuffer(true);
             }
             else if(!this->isEnabled())
             {
-                char msg[MAX_MSG_LENGTH + 1];
-                msg[MAX_MSG_LENGTH] = '\0';
-                line_t NewLine = {0,0,0,0};
+                pk_buf_t *pk;
 
-                if(!CL_get_msg(msg))
+                for(; (pk = CL_get_msg_pak()) != NULL;)
                 {
-                    for(int i=0; i < MAX_MSG_LENGTH; i+=4)
-                    {
-                        if(msg[i])
-                            NewLine.x0 = msg[i];
-                        else
-                            break;
-                        if(msg[i+1])
-                            NewLine.y0 = msg[i+1];
-                        else
-                            break;
-                        if(msg[i+2])
-                            NewLine.x1 = msg[i+2];
-                        else
-                            break;
-                        if(msg[i+3])
-                            NewLine.y1 = msg[i+3];
-                        else
-                            break;
-
-                        if(NewLine.x0 == 255 && NewLine.y0 == 255 && NewLine.x1 == 255 && NewLine.y1 == 255)
-                            CmdLines.clear();
-                        else
-                            CmdLines.push_back(NewLine);
-
-#ifdef _DEBUG
-                        std::printf("RCWindow::newline: %d %d %d %d\n" ,NewLine.x0, NewLine.y0, NewLine.x1, NewLine.y1);
-#endif // _DEBUG
-
-                    }
+                    ReceiveStrokes(PK_data(pk), PK_length(pk));
+                    LT_mark(pk, LT_UI_APPLY);
+                    PK_free(pk);
                 }
             }
 
@@ -254,43 +221,32 @@ int GlWindow :: handleEvent( mxEvent *event )
 //        int i = 0;
 	    line_t NewLine = {x0,y0,x1,y1};
 
-//	    PrevLine = NewLine;
-	    if(Buffer.size() < MAX_MSG_LENGTH/4)
+        seqline_t NewSeqLine;
+
+        if(Erasing)
         {
-            unsigned char msg[MAX_MSG_LENGTH + 1];
-            msg[MAX_MSG_LENGTH] = '\0';
-            int i = 0;
+            Erasing = false;
+            break;
+        }
 
-            msg[MAX_MSG_LENGTH] = '\0';
+//	    PrevLine = NewLine;
+        if(Buffer.empty())
+            BufferStart = millis();
 
-            CmdLines.push_back(NewLine);
-            Buffer.push_back(NewLine);
+        NewSeqLine.line = NewLine;
+        NewSeqLine.seq = NextSeq++;
+        NewSeqLine.sent = 0;
+
+        CmdLines.push_back(NewLine);
+        CmdSeqs.push_back(NewSeqLine.seq);
+        Buffer.push_back(NewSeqLine);
+        RedoLines.clear();
 
 #ifdef _DEBUG
-            std::printf("SDWindow::newline\n");
+        std::printf("SDWindow::newline\n");
 #endif /*// _DEBUG*/
 
-            for(drawlines_t::iterator iter_buffer = Buffer.begin(); iter_buffer != Buffer.end() && i < MAX_MSG_LENGTH; ++iter_buffer, i+=4)
-            {
-            msg[i] = iter_buffer->x0;
-            msg[i+1] = iter_buffer->y0;
-            msg[i+2] = iter_buffer->x1;
-            msg[i+3] = iter_buffer->y1;
-            }
-
-            msg[i] = '\0';
-
-            if(Buffer.size() == MAX_MSG_LENGTH/4)
-            {
-                SV_insert_msg(msg);
-                Buffer.clear();
-            }
-            else
-                if(!SV_insert_msg_nb(msg))
-                    Buffer.clear();
-        }
-        else if(Buffer.size() > MAX_MSG_LENGTH/4)
-                Buffer.clear();
+        FlushBuffer(false);
 
 	    x0 = 0;
 	    y0 = 0;
@@ -304,8 +260,14 @@ int GlWindow :: handleEvent( mxEvent *event )
 	{
 //	    std::printf("%d,%d\n", event->x, event->y);
 //      std::printf("%d,%d,%d,%d\n", x0, y0,x1,y1);
-	    x0 = unsigned (char( event->x * 255.0f / w2() ));
-	    y0 = unsigned (char( event->y * 255.0f / h2() ));
+	    if(event->buttons & mxEvent::MouseRightButton)
+	    {
+	        Erasing = true;
+	        LineErase(ToCoord(event->x, w2()), ToCoord(event->y, h2()));
+	        return 1;
+	    }
+	    x0 = ToCoord(event->x, w2());
+	    y0 = ToCoord(event->y, h2());
 	    x1 = x0;
 	    y1 = y0;
 
@@ -316,8 +278,10 @@ int GlWindow :: handleEvent( mxEvent *event )
 	case mxEvent::MouseDrag:
 	{
 //	    std::printf("%d,%d,%d,%d\n", x0, y0,x1,y1);
-	    x1 = unsigned (char( event->x * 255.0f / w2() ));
-	    y1 = unsigned (char( event->y * 255.0f / h2() ));
+	    if(Erasing)
+	        return 1;
+	    x1 = ToCoord(event->x, w2());
+	    y1 = ToCoord(event->y, h2());
 
 		redraw ();
 
@@ -331,6 +295,8 @@ int GlWindow :: handleEvent( mxEvent *event )
 
 void GlWindow :: draw( void )
 {
+    PR_PROBE1(draw_begin, (int)CmdLines.size());
+
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
@@ -346,6 +312,10 @@ void GlWindow :: draw( void )
 
     for(drawlines_t::iterator iter_lines = CmdLines.begin(); iter_lines != CmdLines.end(); ++iter_lines)
     {
+        size_t slot = iter_lines - CmdLines.begin();
+        if(slot < LineState.size() && LineState[slot] != LINE_PRESENT)
+            continue;
+
         glVertex2f(iter_lines->x0 * 2.0f / 255.0f -1.0f, iter_lines->y0 * -2.0f / 255.0f +1.0f);
         glVertex2f(iter_lines->x1 * 2.0f / 255.0f -1.0f, iter_lines->y1 * -2.0f / 255.0f +1.0f);
     }
@@ -355,18 +325,300 @@ void GlWindow :: draw( void )
 
     glEnd();
 
+    PR_PROBE1(draw_end, (int)CmdLines.size());
 
 //    glFlush();
 
 //    glPopMatrix();
 }
 
+/*
+============
+FlushBuffer
+
+  Hands full packets of buffered lines to the server, each line exactly
+  once. A packet opens with a STROKE_OP_BASE record giving the number of
+  its first line; another one is only needed where numbers skip, e.g.
+  after an unsent line was erased. A partly filled packet is only sent
+  when force is set, i.e. once the oldest buffered line has waited
+  COALESCE_DELAY. Lines the server queue can't take yet stay buffered
+  for the next attempt.
+============
+*/
+void GlWindow :: FlushBuffer( bool force )
+{
+    pk_buf_t *pk;
+    unsigned char *msg;
+    size_t k;
+    int n;
+    int ticket;
+
+    while(!Buffer.empty())
+    {
+        /* records are written straight into the packet the link sends */
+        pk = PK_alloc();
+        if(!pk)
+            break;
+        msg = PK_data(pk);
+
+        for(n=0, k=0; k < Buffer.size(); k++)
+        {
+            bool base = !k || Buffer[k].seq != (unsigned short)(Buffer[k-1].seq + 1);
+
+            if(n + (base ? 2 : 1) > STROKE_RECORDS)
+                break;
+
+            if(base)
+            {
+                msg[n*4] = STROKE_ESCAPE;
+                msg[n*4+1] = STROKE_OP_BASE;
+                msg[n*4+2] = Buffer[k].seq >> 8;
+                msg[n*4+3] = Buffer[k].seq & 255;
+                n++;
+            }
+
+            msg[n*4] = Buffer[k].line.x0;
+            msg[n*4+1] = Buffer[k].line.y0;
+            msg[n*4+2] = Buffer[k].line.x1;
+            msg[n*4+3] = Buffer[k].line.y1;
+            n++;
+        }
+
+        if(n < STROKE_RECORDS && !force)
+        {
+            PK_free(pk);
+            break;
+        }
+
+        PK_put(pk, n*4);
+        ticket = SV_post_pak_lane(pk, SV_LANE_DATA);
+        PK_free(pk);
+        if(ticket <= 0)
+            break;
+        LT_record(LT_UI_BUFFER, (millis() - BufferStart) * 1000);
+
+        Buffer.erase(Buffer.begin(), Buffer.begin() + k);
+        BufferStart = millis();
+    }
+}
+
+/*
+============
+PostOp
+
+  Operations go on the control lane, so they may overtake the strokes
+  they refer to; ReceiveStrokes copes with either order.
+============
+*/
+void GlWindow :: PostOp( unsigned char op, unsigned short seq )
+{
+    unsigned char msg[4];
+
+    msg[0] = STROKE_ESCAPE;
+    msg[1] = op;
+    msg[2] = seq >> 8;
+    msg[3] = seq & 255;
+
+    for(; SV_post_msg_lane(msg, 4, SV_LANE_CONTROL) == -1;)
+        delay(BAUD_RATE);
+}
+
+/*
+============
+ReceiveStrokes
+
+  Applies a packet of stroke records. CmdLines holds one slot per line
+  number, so undo, redo and erase only flip LineState flags and an
+  operation that arrives before its line is simply remembered.
+============
+*/
+void GlWindow :: ReceiveStrokes( const unsigned char *msg, int length )
+{
+    int i;
+
+    for(i=0; i + 4 <= length; i+=4)
+    {
+        if(msg[i] == STROKE_ESCAPE)
+        {
+            unsigned char op = msg[i+1];
+            unsigned short seq = (msg[i+2] << 8) | msg[i+3];
+
+            if(op == STROKE_OP_CLEAR)
+            {
+                CmdLines.clear();
+                LineState.clear();
+                RecvSeq = 0;
+                continue;
+            }
+            if(op == STROKE_OP_BASE)
+            {
+                RecvSeq = seq;
+                continue;
+            }
+            if(op == STROKE_OP_NOP)
+                continue;
+
+            if(seq >= CmdLines.size())
+            {
+                line_t NoLine = {0,0,0,0};
+                CmdLines.resize(seq + 1, NoLine);
+                LineState.resize(seq + 1, 0);
+            }
+
+            if(op == STROKE_OP_UNDO)
+                LineState[seq] |= LINE_HIDDEN;
+            else if(op == STROKE_OP_REDO)
+                LineState[seq] &= ~LINE_HIDDEN;
+            else if(op == STROKE_OP_ERASE)
+                LineState[seq] |= LINE_ERASED;
+
+#ifdef _DEBUG
+            std::printf("RCWindow::op %d on line %d\n", op, seq);
+#endif // _DEBUG
+        }
+        else
+        {
+            line_t NewLine = {msg[i], msg[i+1], msg[i+2], msg[i+3]};
+
+            if(RecvSeq >= CmdLines.size())
+            {
+                line_t NoLine = {0,0,0,0};
+                CmdLines.resize(RecvSeq + 1, NoLine);
+                LineState.resize(RecvSeq + 1, 0);
+            }
+            CmdLines[RecvSeq] = NewLine;
+            LineState[RecvSeq] |= LINE_PRESENT;
+            RecvSeq++;
+
+#ifdef _DEBUG
+            std::printf("RCWindow::newline: %d %d %d %d\n" ,NewLine.x0, NewLine.y0, NewLine.x1, NewLine.y1);
+#endif // _DEBUG
+        }
+    }
+}
+
+void GlWindow :: LineUndo(){
+
+    seqline_t Line;
+
+    if(CmdLines.empty())
+        return;
+
+    Line.line = CmdLines.back();
+    Line.seq = CmdSeqs.back();
+    CmdLines.pop_back();
+    CmdSeqs.pop_back();
+
+    // a line still waiting in Buffer never needs to cross the wire
+    if(!Buffer.empty() && Buffer.back().seq == Line.seq)
+    {
+        Buffer.pop_back();
+        Line.sent = 0;
+    }
+    else
+    {
+        Line.sent = 1;
+        PostOp(STROKE_OP_UNDO, Line.seq);
+    }
+
+    RedoLines.push_back(Line);
+    redraw();
+
+}
+
+void GlWindow :: LineRedo(){
+
+    seqline_t Line;
+
+    if(RedoLines.empty())
+        return;
+
+    Line = RedoLines.back();
+    RedoLines.pop_back();
+    CmdLines.push_back(Line.line);
+    CmdSeqs.push_back(Line.seq);
+
+    if(Line.sent)
+        PostOp(STROKE_OP_REDO, Line.seq);
+    else
+    {
+        if(Buffer.empty())
+            BufferStart = millis();
+        Buffer.push_back(Line);
+        FlushBuffer(false);
+    }
+
+    redraw();
+
+}
+
+/*
+============
+LineErase
+
+  Removes the most recent line passing within a few units of (x, y).
+============
+*/
+void GlWindow :: LineErase( unsigned char x, unsigned char y ){
+
+    int best = -1;
+    float bestdist = 4.0f * 4.0f;
+    int i;
+
+    for(i = int(CmdLines.size()) - 1; i >= 0; i--)
+    {
+        float dx = float(CmdLines[i].x1) - CmdLines[i].x0;
+        float dy = float(CmdLines[i].y1) - CmdLines[i].y0;
+        float px = float(x) - CmdLines[i].x0;
+        float py = float(y) - CmdLines[i].y0;
+        float len = dx * dx + dy * dy;
+        float t = len > 0.0f ? (px * dx + py * dy) / len : 0.0f;
+        float dist;
+
+        if(t < 0.0f)
+            t = 0.0f;
+        if(t > 1.0f)
+            t = 1.0f;
+        dist = (px - t * dx) * (px - t * dx) + (py - t * dy) * (py - t * dy);
+        if(dist < bestdist)
+        {
+            bestdist = dist;
+            best = i;
+        }
+    }
+
+    if(best < 0)
+        return;
+
+    bool sent = true;
+    for(seqlines_t::iterator iter_buffer = Buffer.begin(); iter_buffer != Buffer.end(); ++iter_buffer)
+        if(iter_buffer->seq == CmdSeqs[best])
+        {
+            Buffer.erase(iter_buffer);
+            sent = false;
+            break;
+        }
+
+    if(sent)
+        PostOp(STROKE_OP_ERASE, CmdSeqs[best]);
+
+    CmdLines.erase(CmdLines.begin() + best);
+    CmdSeqs.erase(CmdSeqs.begin() + best);
+    redraw();
+
+}
+
 void GlWindow :: LineClear(){
 
-    unsigned char msg[5] = {255, 255, 255, 255, 0};
+    unsigned char msg[4] = {STROKE_ESCAPE, STROKE_OP_CLEAR, 255, 255};
     Buffer.clear();
-    SV_insert_msg(msg);
+    RedoLines.clear();
+    SV_drop_lane(SV_LANE_DATA);     // queued strokes would be cleared anyway
+    for(; SV_post_msg_lane(msg, 4, SV_LANE_CONTROL) == -1;)
+        delay(BAUD_RATE);
     CmdLines.clear();
+    CmdSeqs.clear();
+    NextSeq = 0;
     redraw();
 
 }
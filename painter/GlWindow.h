@@ -24,6 +24,9 @@
 
 #include "CmdLine.h"
 
+// lines wait at most this long (ms) for a packet to fill before they are sent
+#define COALESCE_DELAY (BAUD_RATE * 4)
+
 class GlWindow : public mxGlWindow //should be replaced with QOpenGLWidget in Qt
 {
 public:
@@ -39,10 +42,23 @@ public:
     void InsertLine (const line_t &newline) { CmdLines.push_back(newline); redraw(); }
 //    line_t FetchLine ( void ) const { return PrevLine; }
     void LineClear() ;
-    void LineUndo () { if(!CmdLines.empty()) CmdLines.pop_back(); redraw(); }
+    void LineUndo () ;
+    void LineRedo () ;
+    void LineErase (unsigned char x, unsigned char y) ;
 private:
-    drawlines_t CmdLines;
-    drawlines_t Buffer;
+    void FlushBuffer (bool force);
+    void PostOp (unsigned char op, unsigned short seq);
+    void ReceiveStrokes (const unsigned char *msg, int length);
+
+    drawlines_t CmdLines;   // sender: drawn lines, receiver: slot per sequence number
+    std::vector<unsigned short> CmdSeqs;    // sender: sequence number of each CmdLines entry
+    std::vector<unsigned char> LineState;   // receiver: LINE_* flags of each CmdLines slot
+    seqlines_t Buffer;      // lines not yet handed to the server, oldest first
+    seqlines_t RedoLines;
+    unsigned int BufferStart;
+    unsigned short NextSeq; // sender: number of the next new line
+    unsigned short RecvSeq; // receiver: number of the next line in a packet
+    bool Erasing;
 //    line_t PrevLine;
     unsigned char x0;
     unsigned char y0;
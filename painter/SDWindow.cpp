@@ -66,7 +66,7 @@ SDWindow :: SDWindow() : mxWindow( 0, 0, 0, 0, 0, "Sender Window", mxWindow::Nor
 	menuAction->add ("Display Information", IDC_ACTION_INFO);
 	menuAction->addSeparator ();
 	menuAction->add ("Undo", IDC_ACTION_UNDO);
-//	menuAction->add ("Redo", IDC_ACTION_REDO);
+	menuAction->add ("Redo", IDC_ACTION_REDO);
 	menuAction->addSeparator ();
 	menuAction->add ("Clear Sceen", IDC_ACTION_CLS);
 //	menuAction->add ("Refresh", IDC_ACTION_REFRESH);
@@ -129,6 +129,10 @@ SDWindow::handleEvent (mxEvent *event)
             getGlWindow()->LineUndo();
             break;
 
+        case IDC_ACTION_REDO:
+            getGlWindow()->LineRedo();
+            break;
+
 		case IDC_HELP_ABOUT:
 			mxMessageBox (this,
 				"Painter P20\n"
@@ -1,6 +1,6 @@
 /*
 
-===== sotfgpio.c ========================================================
+===== action.c ========================================================
 
 */
 
@@ -16,87 +16,432 @@
 
 #include "shared.h"
 #include "server.h"
+#include "loadgen.h"
+#include "tune.h"
 
 #include "action.h"
 
 
-void CMD_help()
-{
-    printf("------------------\n"
-           "svsendmsg" " <string>"
-           "\n"
-           "\n"
-           "sdecho"
-           "\n"
-           "sdputc" " <char>"
-           "\n"
-           "sdflush"
-           "\n"
-           "rcecho"
-           "\n"
-           "rcgetc"
-           "\n"
-           "rcflush"
-           "\n"
-           "\n"
-           "help"
-           "\n"
-           "quit"
-           "\n"
-           "------------------\n"
-          );
+#define	MAX_CMD_LENGTH      256
+#define	MAX_EXEC_DEPTH      8
+
+
+typedef struct
+{
+    char *name;
+    char *args;
+    void (*func)(char *args);
+    char *help;
+} cmd_t;
+
+
+static int cmd_exec_depth;
+static int cmd_last_ticket;
+static link_t *cmd_link = &link_default;    /* link the sv/sd/rc commands work on */
+
+
+static char *CMD_skip_white(char *s)
+{
+    while(*s == ' ' || *s == '\t')
+        s++;
+    return s;
 }
 
-void action_main()
+static char *CMD_state_name(int state)
 {
-    char cmd[128];
-    char narg[128];
+    switch(state)
+    {
+        case SV_MSG_PENDING : return "pending";
+        case SV_MSG_SENDING : return "sending";
+        case SV_MSG_SENT : return "sent";
+        case SV_MSG_FAILED : return "failed";
+        case SV_MSG_DROPPED : return "dropped";
+    }
+    return "expired";
+}
 
-    for(; !flag_sender_ready || !flag_receiver_ready;)
+/*
+============
+command handlers
+
+  none of these may block on the link, apart from the explicit
+  svwait, linkrate, linktune and sleep commands used by scripts
+============
+*/
+static void CMD_post(char *args, int lane)
+{
+    int ticket;
+
+    ticket = SV_post(cmd_link, (unsigned char *)args, strlen(args), lane);
+    if(ticket == -1)
+        printf("Server::queue is full, message dropped\n");
+    else if(ticket == -2)
+        printf("Server::invalid message length, aborted!\n");
+    else
+    {
+        cmd_last_ticket = ticket;
+        if(!cmd_exec_depth)
+            printf("ticket %d\n", ticket);
+    }
+}
+
+static void CMD_svsendmsg(char *args)
+{
+    CMD_post(args, SV_LANE_DATA);
+}
+
+static void CMD_svsendctl(char *args)
+{
+    CMD_post(args, SV_LANE_CONTROL);
+}
+
+static void CMD_svstatus(char *args)
+{
+    int ticket;
+
+    ticket = *args ? atoi(args) : cmd_last_ticket;
+    printf("ticket %d: %s\n", ticket, CMD_state_name(SV_state(cmd_link, ticket)));
+}
+
+static void CMD_svwait(char *args)
+{
+    int ticket;
+    int state;
+
+    ticket = *args ? atoi(args) : cmd_last_ticket;
+    for(state = SV_state(cmd_link, ticket); state == SV_MSG_PENDING || state == SV_MSG_SENDING; state = SV_state(cmd_link, ticket))
         delay(BAUD_RATE);
+    printf("ticket %d: %s\n", ticket, CMD_state_name(state));
+}
 
-    printf("Enter 'help' for a list of commands\n");
-    for(;;)
+static void CMD_svqueue(char *args)
+{
+    (void)args;
+    SV_print(cmd_link);
+}
+
+static void CMD_sdecho(char *args)
+{
+    (void)args;
+    SD_print(cmd_link);
+}
+
+static void CMD_sdputc(char *args)
+{
+    if(buffer_full(&cmd_link->sd_buffer))
+        printf("Sender::buffer is full\n");
+    else
+        SD_put(cmd_link, *args);
+}
+
+static void CMD_sdflush(char *args)
+{
+    (void)args;
+    SD_flush(cmd_link);
+}
+
+static void CMD_rcecho(char *args)
+{
+    (void)args;
+    RC_print(cmd_link);
+}
 
+static void CMD_rcgetc(char *args)
+{
+    (void)args;
+    if(buffer_empty(&cmd_link->rc_buffer))
+        printf("Receiver::buffer is empty\n");
+    else
+        printf("%d\n", RC_get(cmd_link));
+}
+
+static void CMD_rcflush(char *args)
+{
+    (void)args;
+    RC_flush(cmd_link);
+}
+
+static void CMD_pkpool(char *args)
+{
+    int used, peak, failed;
+
+    (void)args;
+    PK_stats(&used, &peak, &failed);
+    printf("packet buffers: %d of %d in use, peak %d, %d allocations failed\n", used, PK_POOL_SIZE, peak, failed);
+}
+
+static void CMD_latency(char *args)
+{
+    if(!*args)
+        LT_print();
+    else if(!strcmp(args, "reset"))
+        LT_reset();
+    else if(!strncmp(args, "dump ", 5))
     {
-        gets(cmd);
+        args = CMD_skip_white(args + 5);
+        if(LT_dump(args))
+            printf("latency: out of memory\n");
+    }
+    else
+        printf("usage: latency [reset | dump <file>]\n");
+}
 
-        strcpy(narg,cmd);
-        narg[9]='\0';
+static void CMD_trace(char *args)
+{
+#ifdef _SOFTGPIO
+    int n;
 
-        if(!strcmp(narg,"svsendmsg"))
-            SV_insert_msg(&cmd[10]);
+    if(!strncmp(args, "start ", 6))
+    {
+        pinTraceStart(CMD_skip_white(args + 6));
+        return;
+    }
+    if(!strcmp(args, "stop"))
+    {
+        if(!pinTraceActive())
+            printf("trace: not running\n");
+        else if((n = pinTraceStop()) < 0)
+            printf("trace: couldn't write the dump\n");
+        else
+            printf("trace: %d events\n", n);
+        return;
+    }
+    printf("usage: trace start <file.vcd> | stop\n");
+#else
+    printf("trace: needs softgpio\n");
+#endif
+}
 
-        if(!strcmp(cmd,"sdecho"))
-            SD_print_buffer();
+static void CMD_link(char *args)
+{
+    link_t *l;
 
-        strcpy(narg,cmd);
-        narg[6]='\0';
+    if(*args)
+    {
+        l = LK_find(atoi(args));
+        if(!l)
+        {
+            printf("no link %s\n", args);
+            return;
+        }
+        cmd_link = l;
+        cmd_last_ticket = 0;
+    }
+    printf("link %d, pins %d..%d\n", cmd_link->id, cmd_link->id * LINK_PINS, cmd_link->id * LINK_PINS + LINK_PINS - 1);
+}
 
-        if(!strcmp(narg,"sdputc"))
-            SD_buffer_put(cmd[7]);
+static void CMD_loadgen(char *args)
+{
+    char pattern[32];
+    int rate;
+    int count = 0;
 
-        if(!strcmp(cmd,"sdflush"))
-            SD_flush_buffer();
+    if(!strcmp(args, "stop"))
+        LG_stop();
+    else if(!*args || !strcmp(args, "stat"))
+        LG_print_stats();
+    else if(sscanf(args, "%31s %d %d", pattern, &rate, &count) < 2 || LG_start(pattern, rate, count))
+        printf("usage: loadgen <walk|hatch|burst|clear> <strokes/s> [count] | stop | stat\n");
+}
 
-        /*if(!strcmp(cmd,"rcsync"))
-            RC_sync();*/
+static void CMD_linkrate(char *args)
+{
+    if(*args)
+        TN_set_period(atoi(args));
+    printf("bit period: tx %d ms, rx %d ms\n", link_tx_period, link_rx_period);
+}
 
-        if(!strcmp(cmd,"rcecho"))
-            RC_print_buffer();
+static void CMD_linktune(char *args)
+{
+    (void)args;
+    TN_tune();
+}
 
-        if(!strcmp(cmd,"rcgetc"))
-            printf("%d\n", RC_buffer_get());
+static void CMD_profile(char *args)
+{
+    lp_profile_t *p;
 
-        if(!strcmp(cmd,"rcflush"))
-            RC_flush_buffer();
+    if(!*args)
+        LP_print();
+    else if(!strncmp(args, "load ", 5))
+    {
+        args = CMD_skip_white(args + 5);
+        if(LP_load(args) >= 0)
+            LP_print();
+    }
+    else if(!(p = LP_find(args)))
+        printf("no profile %s\n", args);
+    else if(!TN_profile(p))
+        printf("link is on profile %s, bit period %d ms\n", p->name, link_tx_period);
+}
 
-        if(!strcmp(cmd,"help"))
-            CMD_help();
+static void CMD_autotune(char *args)
+{
+    (void)args;
+    if(!LP_count())
+        printf("autotune: no profiles, load some with 'profile load <file>'\n");
+    else
+        TN_autotune();
+}
 
-        if(!strcmp(cmd,"quit"))
-            exit(0);
+static void CMD_exec(char *args)
+{
+    FILE *f;
+    char line[MAX_CMD_LENGTH];
 
+    if(cmd_exec_depth >= MAX_EXEC_DEPTH)
+    {
+        printf("exec: scripts nested too deeply, aborted!\n");
+        return;
     }
 
+    f = fopen(args, "r");
+    if(!f)
+    {
+        printf("exec: couldn't open %s\n", args);
+        return;
+    }
+
+    cmd_exec_depth++;
+    while(fgets(line, sizeof(line), f))
+        CMD_exec_line(line);
+    cmd_exec_depth--;
+
+    fclose(f);
+}
+
+static void CMD_repeat(char *args)
+{
+    char line[MAX_CMD_LENGTH];
+    int n;
+
+    n = atoi(args);
+    for(; *args && *args != ' ' && *args != '\t'; args++)
+        ;
+    args = CMD_skip_white(args);
+
+    if(cmd_exec_depth >= MAX_EXEC_DEPTH)
+    {
+        printf("repeat: commands nested too deeply, aborted!\n");
+        return;
+    }
+
+    cmd_exec_depth++;
+    for(; n > 0; n--)
+    {
+        strcpy(line, args);     /* handlers may modify their arguments */
+        CMD_exec_line(line);
+    }
+    cmd_exec_depth--;
+}
+
+static void CMD_sleep(char *args)
+{
+    delay(atoi(args));
+}
+
+static void CMD_echo(char *args)
+{
+    printf("%s\n", args);
+}
+
+static void CMD_help(char *args);
+
+static void CMD_quit(char *args)
+{
+    (void)args;
+    exit(0);
+}
+
+static cmd_t cmd_table[] =
+{
+    {"svsendmsg", "<string>", CMD_svsendmsg, "queue a message, prints its ticket"},
+    {"svsendctl", "<string>", CMD_svsendctl, "queue a message on the control lane"},
+    {"svstatus", "[ticket]", CMD_svstatus, "state of a queued message"},
+    {"svwait", "[ticket]", CMD_svwait, "wait until a message is sent or failed"},
+    {"svqueue", "", CMD_svqueue, "print the server queue"},
+    {"sdecho", "", CMD_sdecho, "print the sender buffer"},
+    {"sdputc", "<char>", CMD_sdputc, "put a raw byte to the sender"},
+    {"sdflush", "", CMD_sdflush, "flush the sender buffer"},
+    {"rcecho", "", CMD_rcecho, "print the receiver buffer"},
+    {"rcgetc", "", CMD_rcgetc, "get a raw byte from the receiver"},
+    {"rcflush", "", CMD_rcflush, "flush the receiver buffer"},
+    {"pkpool", "", CMD_pkpool, "print packet buffer pool usage"},
+    {"latency", "[reset|dump f]", CMD_latency, "print, reset or save per stage latencies"},
+    {"trace", "start f|stop", CMD_trace, "record pin reads and writes into a VCD file"},
+    {"link", "[n]", CMD_link, "print or select the link sv, sd and rc commands use"},
+    {"loadgen", "<pattern> <rate>", CMD_loadgen, "start, stop or report synthetic stroke load"},
+    {"linkrate", "[ms]", CMD_linkrate, "print or set the serial bit period"},
+    {"linktune", "", CMD_linktune, "find the fastest clean bit period"},
+    {"profile", "[load f|name]", CMD_profile, "list, load or switch to link profiles"},
+    {"autotune", "", CMD_autotune, "try every profile, keep the one with the best goodput"},
+    {"exec", "<file>", CMD_exec, "run commands from a script file"},
+    {"repeat", "<n> <command>", CMD_repeat, "run a command n times"},
+    {"sleep", "<ms>", CMD_sleep, "pause the console"},
+    {"echo", "<string>", CMD_echo, "print a string"},
+    {"help", "", CMD_help, "this list"},
+    {"quit", "", CMD_quit, "exit the program"},
+    {NULL, NULL, NULL, NULL}
+};
+
+static void CMD_help(char *args)
+{
+    cmd_t *cmd;
+
+    (void)args;
+    printf("------------------\n");
+    for(cmd = cmd_table; cmd->name; cmd++)
+        printf("%-10s %-16s %s\n", cmd->name, cmd->args, cmd->help);
+    printf("------------------\n");
+}
+
+/*
+============
+CMD_exec_line
+
+  Parses one console or script line and runs it.
+  Blank lines and lines starting with '#' or '//' are ignored.
+============
+*/
+void CMD_exec_line(char *line)
+{
+    cmd_t *cmd;
+    char *args;
+    int len;
+
+    len = strlen(line);
+    while(len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+        line[--len] = '\0';
+
+    line = CMD_skip_white(line);
+    if(!*line || *line == '#' || (line[0] == '/' && line[1] == '/'))
+        return;
+
+    for(args = line; *args && *args != ' ' && *args != '\t'; args++)
+        ;
+    if(*args)
+        *args++ = '\0';
+    args = CMD_skip_white(args);
+
+    for(cmd = cmd_table; cmd->name; cmd++)
+        if(!strcmp(line, cmd->name))
+        {
+            cmd->func(args);
+            return;
+        }
+
+    printf("unknown command '%s', enter 'help' for a list of commands\n", line);
+}
+
+void action_main()
+{
+    char cmd[MAX_CMD_LENGTH];
+
+    for(; !flag_sender_ready || !flag_receiver_ready;)
+        delay(BAUD_RATE);
+
+    printf("Enter 'help' for a list of commands\n");
+    while(fgets(cmd, sizeof(cmd), stdin))
+        CMD_exec_line(cmd);
+
 }
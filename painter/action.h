@@ -22,6 +22,8 @@ extern "C"
 {
 #endif
 
+void CMD_exec_line(char *line);
+
 void action_main();
 
 #ifdef __cplusplus
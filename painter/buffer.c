@@ -18,12 +18,13 @@ void buffer_init(ring_buffer *buffer_ptr, int size)
     buffer_ptr->size = size;
     buffer_ptr->get_index = 0;
     buffer_ptr->put_index = 0;
+    buffer_ptr->overruns = 0;
     buffer_ptr->address = (ElemType *)calloc(buffer_ptr->size, sizeof(ElemType));
 }
 
 void buffer_print(ring_buffer *buffer_ptr)
 {
-    printf("size = 0x%x, get_index = %d, put_index = %d\n", buffer_ptr->size, buffer_ptr->get_index, buffer_ptr->put_index);
+    printf("size = 0x%x, get_index = %d, put_index = %d, overruns = %d\n", buffer_ptr->size, buffer_ptr->get_index, buffer_ptr->put_index, buffer_ptr->overruns);
 }
 
 int buffer_full(ring_buffer *buffer_ptr)
@@ -36,6 +37,11 @@ int buffer_empty(ring_buffer *buffer_ptr)
     return buffer_ptr->put_index == buffer_ptr->get_index;
 }
 
+int buffer_count(ring_buffer *buffer_ptr)
+{
+    return (buffer_ptr->put_index - buffer_ptr->get_index) & (2 * buffer_ptr->size - 1);
+}
+
 int _buffer_incr(ring_buffer *buffer_ptr, int pos)
 {
     return (pos + 1) & (2 * buffer_ptr->size - 1);
@@ -45,7 +51,10 @@ void buffer_put(ring_buffer *buffer_ptr, ElemType *elem)
 {
     buffer_ptr->address[buffer_ptr->put_index & (buffer_ptr->size - 1)] = *elem;
     if (buffer_full(buffer_ptr))
+    {
+        buffer_ptr->overruns++;
         buffer_ptr->get_index = _buffer_incr(buffer_ptr, buffer_ptr->get_index);
+    }
     buffer_ptr->put_index = _buffer_incr(buffer_ptr, buffer_ptr->put_index);
 }
 
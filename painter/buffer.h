@@ -30,6 +30,7 @@ typedef struct
     int size;
     int get_index;
     int put_index;
+    int overruns;       /* elements lost to buffer_put on a full buffer */
     ElemType *address;
 } ring_buffer;
 
@@ -39,6 +40,7 @@ void buffer_init(ring_buffer *buffer_ptr, int size);
 void buffer_print(ring_buffer *buffer_ptr);
 int buffer_full(ring_buffer *buffer_ptr);
 int buffer_empty(ring_buffer *buffer_ptr);
+int buffer_count(ring_buffer *buffer_ptr);
 
 void buffer_put(ring_buffer *buffer_ptr, ElemType *elem);
 void buffer_get(ring_buffer *buffer_ptr, ElemType *elem);
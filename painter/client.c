@@ -16,70 +16,172 @@
 #endif
 
 #include "shared.h"
+#include "threads.h"
+#include "probes.h"
 #include "server.h"
 
 #include "client.h"
 
 
-int flag_client_ready;
-int flag_client_isdumping;
-int flag_client_get_ack;
-byte client_crc16[3];
+/*
+============
+CL_get_pak
 
-static char client_msg_buffer[MAX_MSG_LENGTH + 1];
+  Hands the oldest message over to the caller, who frees it when done.
+  Returns NULL if no new message is waiting.
+============
+*/
+pk_buf_t *CL_get_pak ( link_t *l )
+{
+    pk_buf_t *pk = NULL;
+
+    ThreadLock();
+    if(l->cl_msg_get != l->cl_msg_put)
+        pk = l->cl_msgs[l->cl_msg_get++ & (CL_MSG_QUEUE - 1)];
+    ThreadUnlock();
+    if(pk)
+        LT_mark(pk, LT_CL_QUEUE);
+    return pk;
+}
 
+/* a full queue loses its oldest message */
+static void CL_deliver ( link_t *l, pk_buf_t *pk )
+{
+    pk_buf_t *old = NULL;
+
+    LT_start(pk);
+    PR_PROBE2(deliver, l->id, PK_length(pk));
+    ThreadLock();
+    if(l->cl_msg_put - l->cl_msg_get == CL_MSG_QUEUE)
+        old = l->cl_msgs[l->cl_msg_get++ & (CL_MSG_QUEUE - 1)];
+    l->cl_msgs[l->cl_msg_put++ & (CL_MSG_QUEUE - 1)] = pk;
+    ThreadUnlock();
+    PK_free(old);
+}
 
-#ifdef _DEBUG
+pk_buf_t *CL_get_msg_pak ( void )
+{
+    return CL_get_pak(&link_default);
+}
+
+/*
+============
+CL_get_msg
+
+  Copies the oldest message not yet taken as a string, msg must hold MAX_MSG_LENGTH
+  + 1 bytes. Returns -1 while the client is busy with a packet, else
+  0, with an empty string if there was no new message.
+============
+*/
 int CL_get_msg ( char *msg )
 {
-    /*
-    if(strlen(msg) < MAX_MSG_LENGTH)
+    link_t *l = &link_default;
+    pk_buf_t *pk;
+
+    if(!l->cl_ready)
     {
-        printf("Client::not enough space, aborted!\n");
-        return -2;
+#ifdef _DEBUG
+        printf("Client::client is busy\n");
+#endif /*// _DEBUG*/
+        return -1;
     }
-    */
-    if(flag_client_ready)
+
+    msg[0] = '\0';
+    pk = CL_get_pak(l);
+    if(pk)
     {
-        strcpy(msg, client_msg_buffer);
-        client_msg_buffer[0] = '\0';
-        return 0;
+        memcpy(msg, PK_data(pk), PK_length(pk));
+        msg[PK_length(pk)] = '\0';
+        PK_free(pk);
     }
-    else
+    return 0;
+}
+
+/*
+============
+CL_get
+
+  Like CL_get_msg, but binary safe: msg must hold MAX_MSG_LENGTH + 1
+  bytes. Returns the message length, or -1 if no new message is waiting.
+============
+*/
+int CL_get ( link_t *l, byte *msg )
+{
+    pk_buf_t *pk;
+    int length;
+
+    pk = CL_get_pak(l);
+    if(!pk)
         return -1;
+
+    length = PK_length(pk);
+    memcpy(msg, PK_data(pk), length);
+    msg[length] = '\0';
+    PK_free(pk);
+    return length;
 }
-#else
-int CL_get_msg ( char *msg )
+
+int CL_get_msg_len ( byte *msg )
+{
+    return CL_get(&link_default, msg);
+}
+
+static pk_buf_t *CL_alloc ( void )
+{
+    pk_buf_t *pk;
+
+    for(; !(pk = PK_alloc());)
+        delay(BAUD_RATE);
+    return pk;
+}
+
+/*
+============
+CL_decompress
+
+  Swaps a received LZ payload for the message it holds, NULL if it
+  doesn't decode
+============
+*/
+static pk_buf_t *CL_decompress ( pk_buf_t *pk )
 {
-    if(flag_client_ready)
+    pk_buf_t *msg;
+    int length;
+
+    msg = CL_alloc();
+    length = LZ_decompress(PK_data(pk), PK_length(pk), PK_put(msg, MAX_MSG_LENGTH), MAX_MSG_LENGTH);
+    msg->stamp = pk->stamp;
+    PK_free(pk);
+    if(length <= 0)
     {
-        strcpy(msg, client_msg_buffer);
-        client_msg_buffer[0] = '\0';
-        return 0;
+        PK_free(msg);
+        return NULL;
     }
-    else
-        return -1;
+    PK_trim(msg, length);
+    return msg;
 }
-#endif /*// _DEBUG*/
 
-void client_main()
+void CL_main ( link_t *l )
 {
 
-    byte client_pak[BUFFER_SIZE + 1];
-
-    byte *pak_data_length = &client_pak[1];
-    byte *pak_data = &client_pak[2];
+    pk_buf_t *pk;
+    pk_buf_t *ack;
+    byte *ack_data;
+    byte ack_crc[2];
+    byte pak_type;
+    int pak_data_length;
+    byte *pak_data;
     byte *pak_crc;
     byte *pak_crc_byte;
-    byte *pak_end;
 
     int i;
     unsigned short crcvalue;
+    unsigned int arrived;
 
-    for(; !flag_sender_ready || !flag_receiver_ready;)
+    for(; !l->sd_ready || !l->rc_ready;)
         delay(BAUD_RATE);
-    RC_flush_buffer();
-    flag_client_ready = 1;
+    RC_flush(l);
+    l->cl_ready = 1;
 
 #ifdef _DEBUG
             printf("Client::client is ready\n");
@@ -87,73 +189,91 @@ void client_main()
 
     for(;;)
     {
-        client_pak[0] = RC_buffer_get();
+        pak_type = RC_get(l);
+        arrived = l->rc_arrived;
 
-        if(client_pak[0] == 0)    /* data packet */
+        if(pak_type == 0 || pak_type == 1)    /* data packet, plain or LZ compressed */
         {
-            flag_client_ready = 0;
+            l->cl_ready = 0;
+            LT_since(LT_RC_QUEUE, arrived);
+            arrived = micros();
 
 #ifdef _DEBUG
             printf("Client::receiving packet...\n");
 #endif /*// _DEBUG*/
 
-            *pak_data_length = RC_buffer_get();
-            if(*pak_data_length>MAX_MSG_LENGTH)
+            pak_data_length = RC_get(l);
+            if(pak_data_length > MAX_MSG_LENGTH || !pak_data_length)
+            {
                 printf("Client::invalid packet length, aborted!\n");
+                l->cl_ready = 1;
+                continue;
+            }
 
-            for(i=0; i<*pak_data_length; i++)
-                pak_data[i] = RC_buffer_get();
+            /* the payload goes straight into the buffer the consumer gets */
+            pk = CL_alloc();
+            pak_data = PK_put(pk, pak_data_length);
+            for(i=0; i<pak_data_length; i++)
+                pak_data[i] = RC_get(l);
 
-            pak_crc_byte = &pak_data[i];
-            pak_crc_byte[0] = RC_buffer_get();
-            pak_crc_byte[1] = RC_buffer_get();
-            pak_end = &pak_data[i+2];
-            pak_end[0] = '\0';
+            pak_crc_byte = PK_put(pk, 2);
+            pak_crc_byte[0] = RC_get(l);
+            pak_crc_byte[1] = RC_get(l);
 
             CRC_Init(&crcvalue);
-            for(i=0; i<*pak_data_length; i++) /* crc16 CCITT_FALSE */
+            if(pak_type == 1)   /* covers the type byte, see SV_frame */
+                CRC_ProcessByte(&crcvalue, pak_type);
+            for(i=0; i<pak_data_length; i++) /* crc16 CCITT_FALSE */
                 CRC_ProcessByte(&crcvalue, pak_data[i]);
             crcvalue = CRC_Value(crcvalue);
             pak_crc = (byte *) &crcvalue;
 
             if((pak_crc[0] == pak_crc_byte[0] && pak_crc[1] == pak_crc_byte[1]) || (pak_crc[0] == pak_crc_byte[1] && pak_crc[1] == pak_crc_byte[0]))
             {
+                LT_since(LT_CL_REASSEMBLY, arrived);
 
 #ifdef _DEBUG
                 printf("Client::packet received\n");
-                for(i=0; i<*pak_data_length + 4; i++)
+                printf("0 %d ", pak_data_length);
+                for(i=0; i<PK_length(pk); i++)
                 {
-                    printf("%d ", client_pak[i]);
+                    printf("%d ", PK_data(pk)[i]);
                 }
                 printf("\n");
 #endif /*// _DEBUG*/
 
-                printf("Client::new message received:");
-                for(i=0; i<*pak_data_length; i++)
+                ack = CL_alloc();
+                ack_data = PK_put(ack, 3);
+                ack_data[0] = 6;
+                ack_data[1] = pak_crc_byte[0];
+                ack_data[2] = pak_crc_byte[1];
+                SD_send(l, ack);
+                PK_free(ack);
+
+                PK_trim(pk, pak_data_length);
+                if(pak_type == 1)
+                    pk = CL_decompress(pk);
+                if(pk)
                 {
-                    client_msg_buffer[i] = pak_data[i];
-                    /*printf("%c", pak_data[i]);*/
+                    printf("Client::new message received:%.*s\n", PK_length(pk), (char *)PK_data(pk));
+                    CL_deliver(l, pk);
                 }
-                printf("%s\n", client_msg_buffer);
-
-                for(; flag_server_isdumping;)
-                    delay(BAUD_RATE);
-
-                flag_client_isdumping = 1;
-                SD_buffer_put(6);
-                SD_buffer_put(pak_crc_byte[0]);
-                SD_buffer_put(pak_crc_byte[1]);
-                flag_client_isdumping = 0;
+                else
+                    printf("Client::compressed packet doesn't decode, aborted!\n");
 
             }
             else
+            {
                 printf("Client::data packet CRC16 failed, aborted!\n");
+                PR_PROBE2(crc_fail, l->id, pak_data_length);
+                PK_free(pk);
+            }
         }
-        else if(client_pak[0] == 6)    /* ACK packet */
+        else if(pak_type == 6)    /* ACK packet */
         {
-            client_crc16[0] = RC_buffer_get();
-            client_crc16[1] = RC_buffer_get();
-            flag_client_get_ack = 1;
+            ack_crc[0] = RC_get(l);
+            ack_crc[1] = RC_get(l);
+            SV_ack(l, ack_crc[0], ack_crc[1]);
 
 #ifdef _DEBUG
             printf("Client::ACK to local server...\n");
@@ -161,12 +281,17 @@ void client_main()
 
         }
 
-        /*RC_flush_buffer();*/
+        /*RC_flush(l);*/
 
 #ifdef _DEBUG
         printf("Client::client is ready\n");
 #endif /*// _DEBUG*/
 
-        flag_client_ready = 1;
+        l->cl_ready = 1;
     }
 }
+
+void client_main()
+{
+    CL_main(&link_default);
+}
@@ -13,6 +13,9 @@ frame structure
 |0|D0|D1|D2|D3|D4|D5|D6|D7|1|1|
 data packet structure
 |0|length of data|-data-|-|crc16byte0|crc16byte1|
+LZ compressed data packet structure, see compress.h
+|1|length of data|-LZ data-|-|crc16byte0|crc16byte1|
+  the crc16 covers the type byte 1 and the LZ data
 ACK (acknowledge) packet structure
 |6|crc16byte0|crc16byte1|
 
@@ -33,13 +36,14 @@ extern "C"
 {
 #endif
 
-extern int flag_client_ready;
-extern int flag_client_isdumping;
-
-extern int flag_client_get_ack;
-extern byte client_crc16[3];
+int CL_get (link_t *l, byte *msg);
+pk_buf_t *CL_get_pak (link_t *l);
+void CL_main (link_t *l);
 
+/* the same on link_default */
 int CL_get_msg (char *msg);
+int CL_get_msg_len (byte *msg);
+pk_buf_t *CL_get_msg_pak (void);
 
 void client_main();
 
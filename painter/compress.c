@@ -0,0 +1,190 @@
+/*
+
+===== compress.c ========================================================
+
+*/
+
+
+#include <string.h>
+
+#include "shared.h"
+
+
+#define	LZ_HASH_SIZE    (1 << LZ_HASH_BITS)
+
+
+static int LZ_hash(const byte *p)
+{
+    return ((p[0] << 5) ^ (p[1] << 3) ^ p[2] ^ (p[0] >> 3)) & (LZ_HASH_SIZE - 1);
+}
+
+/* the part of a length that didn't fit the token nibble */
+static byte *LZ_put_length(byte *op, byte *oend, int n)
+{
+    for(; n >= 255; n -= 255)
+    {
+        if(op >= oend)
+            return NULL;
+        *op++ = 255;
+    }
+    if(op >= oend)
+        return NULL;
+    *op++ = (byte)n;
+    return op;
+}
+
+static int LZ_get_length(const byte **ip, const byte *iend)
+{
+    int n = 0;
+    byte b;
+
+    do
+    {
+        if(*ip >= iend)
+            return -1;
+        b = *(*ip)++;
+        n += b;
+    } while(b == 255);
+    return n;
+}
+
+/*
+============
+LZ_sequence
+
+  Writes lit literals and a match of length match at offset, match 0
+  for none. Returns the new end of the output, NULL if it won't fit.
+============
+*/
+static byte *LZ_sequence(byte *op, byte *oend, const byte *lit, int lit_length, int match, int offset)
+{
+    int code = match ? match - LZ_MIN_MATCH + 1 : 0;
+
+    if(op >= oend)
+        return NULL;
+    *op++ = (byte)(((lit_length < 15 ? lit_length : 15) << 4) | (code < 15 ? code : 15));
+
+    if(lit_length >= 15 && !(op = LZ_put_length(op, oend, lit_length - 15)))
+        return NULL;
+    if(lit_length > oend - op)
+        return NULL;
+    memcpy(op, lit, lit_length);
+    op += lit_length;
+
+    if(!match)
+        return op;
+    if(code >= 15 && !(op = LZ_put_length(op, oend, code - 15)))
+        return NULL;
+    if(op >= oend)
+        return NULL;
+    *op++ = (byte)offset;
+    return op;
+}
+
+/*
+============
+LZ_compress
+
+  Greedy, one candidate per hash slot. Returns the compressed length,
+  or -1 if it would take more than max bytes.
+============
+*/
+int LZ_compress(const byte *in, int length, byte *out, int max)
+{
+    int table[LZ_HASH_SIZE];
+    const byte *ip = in;
+    const byte *anchor = in;
+    const byte *end = in + length;
+    const byte *ref;
+    byte *op = out;
+    byte *oend = out + max;
+    int match;
+    int h;
+
+    for(h=0; h<LZ_HASH_SIZE; h++)
+        table[h] = -1;
+
+    for(; ip + LZ_MIN_MATCH <= end;)
+    {
+        h = LZ_hash(ip);
+        ref = table[h] < 0 ? NULL : in + table[h];
+        table[h] = ip - in;
+        if(!ref || ip - ref > LZ_MAX_OFFSET || memcmp(ref, ip, LZ_MIN_MATCH))
+        {
+            ip++;
+            continue;
+        }
+
+        for(match=LZ_MIN_MATCH; ip + match < end && ref[match] == ip[match]; match++)
+            ;
+        op = LZ_sequence(op, oend, anchor, ip - anchor, match, ip - ref);
+        if(!op)
+            return -1;
+        ip += match;
+        anchor = ip;
+    }
+
+    if(anchor < end && !(op = LZ_sequence(op, oend, anchor, end - anchor, 0, 0)))
+        return -1;
+    return op - out;
+}
+
+/*
+============
+LZ_decompress
+
+  Returns the decompressed length, or -1 if the input is malformed or
+  would take more than max bytes
+============
+*/
+int LZ_decompress(const byte *in, int length, byte *out, int max)
+{
+    const byte *ip = in;
+    const byte *iend = in + length;
+    byte *op = out;
+    byte *oend = out + max;
+    int lit_length;
+    int match;
+    int offset;
+    int n;
+    byte token;
+
+    for(; ip < iend;)
+    {
+        token = *ip++;
+
+        lit_length = token >> 4;
+        if(lit_length == 15)
+        {
+            if((n = LZ_get_length(&ip, iend)) < 0)
+                return -1;
+            lit_length += n;
+        }
+        if(lit_length > iend - ip || lit_length > oend - op)
+            return -1;
+        memcpy(op, ip, lit_length);
+        ip += lit_length;
+        op += lit_length;
+
+        match = token & 15;
+        if(!match)
+            continue;
+        if(match == 15)
+        {
+            if((n = LZ_get_length(&ip, iend)) < 0)
+                return -1;
+            match += n;
+        }
+        match += LZ_MIN_MATCH - 1;
+
+        if(ip >= iend)
+            return -1;
+        offset = *ip++;
+        if(!offset || offset > op - out || match > oend - op)
+            return -1;
+        for(; match; match--, op++)     /* may overlap, byte by byte */
+            *op = op[-offset];
+    }
+
+    return op - out;
+}
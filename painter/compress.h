@@ -0,0 +1,50 @@
+/*
+//=============================================================================
+//
+// Purpose: LZ compression of packet payloads
+//
+// $NoKeywords: $
+//=============================================================================
+*/
+
+
+#ifndef __COMPRESS__
+#define __COMPRESS__
+
+
+/*
+// compress.h
+*/
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+   A payload is a list of sequences, each some literal bytes followed
+   by a copy of earlier output, in the manner of LZ4:
+
+     |token|literal length..|literals|match length..|offset|
+
+   The token's high nibble is the literal count, the low nibble the
+   match length - LZ_MIN_MATCH + 1, 0 for none. A nibble of 15 is
+   continued by bytes that are added on, up to and including the first
+   one below 255. The offset is a single byte, a packet is far shorter
+   than the LZ4 window and two bytes would eat most of the gain.
+*/
+
+#define	LZ_MIN_MATCH    3
+#define	LZ_MAX_OFFSET   255
+#define	LZ_HASH_BITS    8
+
+int LZ_compress(const byte *in, int length, byte *out, int max);
+int LZ_decompress(const byte *in, int length, byte *out, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /*__COMPRESS__*/
@@ -0,0 +1,657 @@
+/*
+
+===== fileio.c ========================================================
+
+*/
+
+#ifdef _IOURING
+#define _GNU_SOURCE     /* syscall, AT_FDCWD */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifdef _IOURING
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif  /* _IOURING */
+
+#ifdef _SOFTGPIO
+#include "softgpio.h"
+#else
+#include <wiringPi.h>
+#endif
+
+#include "cmdlib.h"
+
+#include "fileio.h"
+
+
+#define	IO_OP_SAVE      0
+#define	IO_OP_LOAD      1
+
+#define	IO_LOAD_CHUNK   0x10000
+
+static io_request_t *io_queue_head;
+static io_request_t *io_queue_tail;
+static int io_outstanding;      /* queued or in progress */
+static int io_started;
+static char *io_backend = "none";
+
+/*
+   The service has a lock of its own: ThreadLock is a no-op outside
+   RunThreadsOn, and on Linux threads.c has no real one at all.
+*/
+#ifdef WIN32
+static CRITICAL_SECTION io_crit;
+static volatile LONG io_crit_state;     /* 0, 1 initializing, 2 ready */
+#else
+static pthread_mutex_t io_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+static void IO_lock(void)
+{
+#ifdef WIN32
+    if(io_crit_state != 2)
+    {
+        if(InterlockedCompareExchange(&io_crit_state, 1, 0) == 0)
+        {
+            InitializeCriticalSection(&io_crit);
+            io_crit_state = 2;
+        }
+        else
+        {
+            for(; io_crit_state != 2;)
+                Sleep(0);
+        }
+    }
+    EnterCriticalSection(&io_crit);
+#else
+    pthread_mutex_lock(&io_mutex);
+#endif
+}
+
+static void IO_unlock(void)
+{
+#ifdef WIN32
+    LeaveCriticalSection(&io_crit);
+#else
+    pthread_mutex_unlock(&io_mutex);
+#endif
+}
+
+
+static void IO_free(io_request_t *req)
+{
+    free(req->buffer);
+    free(req);
+}
+
+static io_request_t *IO_pop(void)
+{
+    io_request_t *req;
+
+    IO_lock();
+    req = io_queue_head;
+    if(req)
+    {
+        io_queue_head = req->next;
+        if(!io_queue_head)
+            io_queue_tail = NULL;
+        req->next = NULL;
+    }
+    IO_unlock();
+    return req;
+}
+
+/*
+============
+IO_complete
+
+  Runs the callback, then lets waiters see the request and drops the
+  service's reference
+============
+*/
+static void IO_complete(io_request_t *req)
+{
+    int last;
+
+    if(req->op == IO_OP_LOAD && req->result >= 0)
+        req->buffer[req->result] = 0;
+    if(req->callback)
+        req->callback(req);
+
+    IO_lock();
+    req->done = 1;
+    io_outstanding--;
+    last = --req->refs == 0;
+    IO_unlock();
+    if(last)
+        IO_free(req);
+}
+
+/*
+=======================================================================
+
+  THREAD POOL
+
+=======================================================================
+*/
+
+static void IO_perform(io_request_t *req)
+{
+    FILE *f;
+    long size;
+
+    req->result = -1;
+    if(req->op == IO_OP_SAVE)
+    {
+        f = fopen(req->filename, req->flags & IO_APPEND ? "ab" : "wb");
+        if(!f)
+            return;
+        if(fwrite(req->buffer, 1, req->length, f) == (size_t)req->length)
+            req->result = req->length;
+        if(fclose(f))
+            req->result = -1;
+        return;
+    }
+
+    f = fopen(req->filename, "rb");
+    if(!f)
+        return;
+    if(!fseek(f, 0, SEEK_END) && (size = ftell(f)) >= 0 && !fseek(f, 0, SEEK_SET) &&
+       (req->buffer = malloc(size + 1)) != NULL &&
+       fread(req->buffer, 1, size, f) == (size_t)size)
+        req->result = req->length = (int)size;
+    fclose(f);
+}
+
+static void IO_worker(void)
+{
+    io_request_t *req;
+
+    for(;;)
+    {
+        req = IO_pop();
+        if(!req)
+        {
+            delay(1);
+            continue;
+        }
+        IO_perform(req);
+        IO_complete(req);
+    }
+}
+
+/*
+=======================================================================
+
+  IO_URING
+
+  Straight on the system calls, no liburing. Every request has at
+  most one entry in the ring at a time and walks through
+  open -> write or read, as often as it takes -> close; the thread
+  polls for completions like everything else here does for its pins.
+
+=======================================================================
+*/
+
+#ifdef _IOURING
+
+#define	IO_STATE_OPEN       0
+#define	IO_STATE_TRANSFER   1
+#define	IO_STATE_CLOSE      2
+
+typedef struct
+{
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned entries;
+    int to_submit;
+    int in_flight;
+} io_ring_t;
+
+static io_ring_t io_ring;
+static int io_use_ring;
+
+static int IO_ring_init(io_ring_t *r)
+{
+    struct io_uring_params p;
+    size_t sq_size, cq_size;
+    char *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, IO_RING_SIZE, &p);
+    if(r->fd < 0)
+        return -1;
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if((p.features & IORING_FEAT_SINGLE_MMAP) && cq_size > sq_size)
+        sq_size = cq_size;
+
+    sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_SQ_RING);
+    if(sq == MAP_FAILED)
+        goto failed;
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+        cq = sq;
+    else if((cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+        goto failed;
+    r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, r->fd, IORING_OFF_SQES);
+    if(r->sqes == MAP_FAILED)
+        goto failed;
+
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->entries = p.sq_entries;
+    return 0;
+
+failed:
+    close(r->fd);   /* only ever once, what got mapped stays */
+    return -1;
+}
+
+/* copies sqe into the ring, IO_ring_main submits it */
+static void IO_ring_push(io_ring_t *r, struct io_uring_sqe *sqe, io_request_t *req)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned index = tail & *r->sq_mask;
+
+    sqe->user_data = (unsigned long)req;
+    r->sqes[index] = *sqe;
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+}
+
+static void IO_ring_open(io_ring_t *r, io_request_t *req)
+{
+    struct io_uring_sqe sqe;
+
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_OPENAT;
+    sqe.fd = AT_FDCWD;
+    sqe.addr = (unsigned long)req->filename;
+    sqe.len = 0644;
+    if(req->op == IO_OP_LOAD)
+        sqe.open_flags = O_RDONLY | O_CLOEXEC;
+    else
+        sqe.open_flags = O_WRONLY | O_CREAT | O_CLOEXEC | (req->flags & IO_APPEND ? O_APPEND : O_TRUNC);
+    req->state = IO_STATE_OPEN;
+    IO_ring_push(r, &sqe, req);
+}
+
+static void IO_ring_close(io_ring_t *r, io_request_t *req)
+{
+    struct io_uring_sqe sqe;
+
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_CLOSE;
+    sqe.fd = req->fd;
+    req->state = IO_STATE_CLOSE;
+    IO_ring_push(r, &sqe, req);
+}
+
+static void IO_ring_transfer(io_ring_t *r, io_request_t *req)
+{
+    struct io_uring_sqe sqe;
+    byte *grown;
+
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.fd = req->fd;
+    if(req->op == IO_OP_SAVE)
+    {
+        sqe.opcode = IORING_OP_WRITE;
+        sqe.addr = (unsigned long)(req->buffer + req->offset);
+        sqe.len = req->length - req->offset;
+        sqe.off = req->flags & IO_APPEND ? ~(__u64)0 : (__u64)req->offset;     /* -1 is the file position */
+    }
+    else
+    {
+        if(req->offset == req->size)    /* keep room for the 0 IO_complete puts behind */
+        {
+            grown = realloc(req->buffer, req->size + IO_LOAD_CHUNK + 1);
+            if(!grown)
+            {
+                req->offset = -1;
+                IO_ring_close(r, req);
+                return;
+            }
+            req->buffer = grown;
+            req->size += IO_LOAD_CHUNK;
+        }
+        sqe.opcode = IORING_OP_READ;
+        sqe.addr = (unsigned long)(req->buffer + req->offset);
+        sqe.len = req->size - req->offset;
+        sqe.off = req->offset;
+    }
+    req->state = IO_STATE_TRANSFER;
+    IO_ring_push(r, &sqe, req);
+}
+
+/*
+============
+IO_ring_advance
+
+  Takes a request one step on from the completion of its last entry,
+  returns 1 once it is through
+============
+*/
+static int IO_ring_advance(io_ring_t *r, io_request_t *req, int res)
+{
+    switch(req->state)
+    {
+    case IO_STATE_OPEN :
+        if(res < 0)
+        {
+            req->result = -1;
+            return 1;
+        }
+        req->fd = res;
+        if(req->op == IO_OP_SAVE && !req->length)
+            IO_ring_close(r, req);
+        else
+            IO_ring_transfer(r, req);
+        return 0;
+
+    case IO_STATE_TRANSFER :
+        if(req->offset < 0 || res < 0)
+            req->offset = -1;
+        else if(res > 0)
+        {
+            req->offset += res;
+            if(req->op == IO_OP_LOAD || req->offset < req->length)
+            {
+                IO_ring_transfer(r, req);
+                return 0;
+            }
+        }
+        else if(req->op == IO_OP_SAVE)  /* wrote nothing */
+            req->offset = -1;
+        IO_ring_close(r, req);
+        return 0;
+
+    default :
+        req->result = req->offset;
+        if(req->op == IO_OP_LOAD)
+            req->length = req->offset;
+        else if(res < 0)    /* the data may not have made it */
+            req->result = -1;
+        return 1;
+    }
+}
+
+static void IO_ring_main(io_ring_t *r)
+{
+    struct io_uring_cqe *cqe;
+    io_request_t *req;
+    unsigned head;
+    int busy;
+
+    for(;;)
+    {
+        busy = 0;
+        for(; r->in_flight < (int)r->entries && (req = IO_pop());)
+        {
+            req->offset = 0;
+            req->size = 0;
+            IO_ring_open(r, req);
+            r->in_flight++;
+            busy = 1;
+        }
+
+        if(r->to_submit)
+        {
+            syscall(__NR_io_uring_enter, r->fd, r->to_submit, 0, 0, NULL, 0);
+            r->to_submit = 0;
+        }
+
+        head = *r->cq_head;
+        for(; head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE); head++)
+        {
+            cqe = &r->cqes[head & *r->cq_mask];
+            req = (io_request_t *)(unsigned long)cqe->user_data;
+            if(IO_ring_advance(r, req, cqe->res))
+            {
+                r->in_flight--;
+                IO_complete(req);
+            }
+            busy = 1;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+        if(!busy)
+            delay(1);
+    }
+}
+
+#endif  /* _IOURING */
+
+#ifdef WIN32
+static DWORD WINAPI IO_thread(LPVOID arg)
+#else
+static void *IO_thread(void *arg)
+#endif
+{
+    (void)arg;
+#ifdef _IOURING
+    if(io_use_ring)
+        IO_ring_main(&io_ring);
+#endif  /* _IOURING */
+    IO_worker();
+    return 0;
+}
+
+/*
+============
+IO_start
+
+  Starts the service threads on the first request. Must hold IO_lock.
+============
+*/
+static void IO_start(void)
+{
+    int threads;
+    int i;
+#ifdef WIN32
+    DWORD id;
+#else
+    pthread_t thread;
+    pthread_attr_t attrib;
+#endif
+
+    io_started = 1;
+    io_backend = "threads";
+    threads = IO_WORKERS;
+
+#ifdef _IOURING
+    if(!IO_ring_init(&io_ring))
+    {
+        io_use_ring = 1;
+        io_backend = "io_uring";
+        threads = 1;
+    }
+#endif  /* _IOURING */
+
+#ifndef WIN32
+    pthread_attr_init(&attrib);
+    pthread_attr_setdetachstate(&attrib, PTHREAD_CREATE_DETACHED);
+#endif
+    for(i=0; i<threads; i++)
+    {
+#ifdef WIN32
+        if(!CreateThread(NULL, 0, IO_thread, NULL, 0, &id))
+            Error("IO_start: CreateThread failed");
+#else
+        if(pthread_create(&thread, &attrib, IO_thread, NULL))
+            Error("IO_start: pthread_create failed");
+#endif
+    }
+#ifndef WIN32
+    pthread_attr_destroy(&attrib);
+#endif
+}
+
+static io_request_t *IO_new(int op, char *filename, void (*callback)(io_request_t *req), void *arg)
+{
+    io_request_t *req;
+
+    req = calloc(1, sizeof(io_request_t));
+    if(!req)
+        return NULL;
+    req->op = op;
+    strncpy(req->filename, filename, IO_MAX_PATH - 1);
+    req->callback = callback;
+    req->arg = arg;
+    req->refs = 2;      /* the caller's and the service's */
+    req->fd = -1;
+    return req;
+}
+
+static void IO_submit(io_request_t *req)
+{
+    IO_lock();
+    if(!io_started)
+        IO_start();
+    if(io_queue_tail)
+        io_queue_tail->next = req;
+    else
+        io_queue_head = req;
+    io_queue_tail = req;
+    io_outstanding++;
+    IO_unlock();
+}
+
+/*
+============
+IO_save
+
+  Queues writing length bytes of data to filename. Unless flags has
+  IO_GIVE the data is copied, the caller may reuse it right away.
+  Returns NULL if out of memory.
+============
+*/
+io_request_t *IO_save(char *filename, void *data, int length, int flags,
+                      void (*callback)(io_request_t *req), void *arg)
+{
+    io_request_t *req;
+
+    req = IO_new(IO_OP_SAVE, filename, callback, arg);
+    if(!req)
+    {
+        if(flags & IO_GIVE)
+            free(data);
+        return NULL;
+    }
+    req->flags = flags;
+    req->length = length;
+    if(flags & IO_GIVE)
+        req->buffer = data;
+    else if((req->buffer = malloc(length ? length : 1)) != NULL)
+        memcpy(req->buffer, data, length);
+    else
+    {
+        free(req);
+        return NULL;
+    }
+
+    IO_submit(req);
+    return req;
+}
+
+/*
+============
+IO_load
+
+  Queues reading all of filename into a new buffer
+============
+*/
+io_request_t *IO_load(char *filename, void (*callback)(io_request_t *req), void *arg)
+{
+    io_request_t *req;
+
+    req = IO_new(IO_OP_LOAD, filename, callback, arg);
+    if(!req)
+        return NULL;
+    IO_submit(req);
+    return req;
+}
+
+/* read under the lock, so the result and buffer are seen complete */
+int IO_done(io_request_t *req)
+{
+    int done;
+
+    IO_lock();
+    done = req->done;
+    IO_unlock();
+    return done;
+}
+
+/* blocks until the request is through, returns its result */
+int IO_wait(io_request_t *req)
+{
+    for(; !IO_done(req);)
+        delay(1);
+    return req->result;
+}
+
+void IO_release(io_request_t *req)
+{
+    int last;
+
+    if(!req)
+        return;
+    IO_lock();
+    last = --req->refs == 0;
+    IO_unlock();
+    if(last)
+        IO_free(req);
+}
+
+/* blocks until every request made so far is through */
+void IO_sync(void)
+{
+    int outstanding;
+
+    for(;;)
+    {
+        IO_lock();
+        outstanding = io_outstanding;
+        IO_unlock();
+        if(!outstanding)
+            break;
+        delay(1);
+    }
+}
+
+char *IO_backend(void)
+{
+    return io_backend;
+}
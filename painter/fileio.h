@@ -0,0 +1,91 @@
+/*
+//=============================================================================
+//
+// Purpose: asynchronous file I/O
+//
+// $NoKeywords: $
+//=============================================================================
+*/
+
+
+#ifndef __FILEIO__
+#define __FILEIO__
+
+
+/*
+// fileio.h
+*/
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+   IO_save and IO_load queue a whole file write or read and return at
+   once, the calling thread never waits for the disk. The work is done
+   on threads of the service: built with -D_IOURING on Linux one thread
+   drives an io_uring, open, transfer and close all go through the ring
+   and any number of requests are in flight. Without it, or where the
+   kernel has no io_uring, IO_WORKERS threads do them with stdio.
+
+   Every request ends with its callback, if it has one, run on a
+   service thread. After that IO_done is true and result holds the
+   bytes written or read, or -1. The caller owns one reference, given
+   back with IO_release; it may do that right away if it only wants
+   the callback. A loaded buffer goes with the request unless the
+   callback takes it and sets buffer to NULL.
+
+   The service locks its queue and references with a mutex of its
+   own, requests can be made from any thread at any time. Callbacks
+   run without it held.
+*/
+
+#define	IO_WORKERS      2       /* stdio threads */
+#define	IO_RING_SIZE    64      /* io_uring entries, also requests in flight */
+#define	IO_MAX_PATH     256
+
+/* IO_save flags */
+#define	IO_TRUNCATE     0       /* replace the file, like SaveFile */
+#define	IO_APPEND       1
+#define	IO_GIVE         2       /* data was malloc'ed and now belongs to the request, no copy */
+
+typedef struct io_request_s
+{
+    int op;
+    int flags;
+    char filename[IO_MAX_PATH];
+    byte *buffer;           /* to write, or read, 0 terminated like LoadFile */
+    int length;
+    int result;             /* bytes, -1 on error */
+    volatile int done;
+    void (*callback)(struct io_request_s *req);
+    void *arg;
+
+    /* service */
+    int refs;
+    int state;
+    int fd;
+    int offset;             /* bytes moved so far */
+    int size;               /* of buffer while reading */
+    struct io_request_s *next;
+} io_request_t;
+
+io_request_t *IO_save(char *filename, void *data, int length, int flags,
+                      void (*callback)(io_request_t *req), void *arg);
+io_request_t *IO_load(char *filename, void (*callback)(io_request_t *req), void *arg);
+
+int IO_done(io_request_t *req);
+int IO_wait(io_request_t *req);
+void IO_release(io_request_t *req);
+void IO_sync(void);
+
+char *IO_backend(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /*__FILEIO__*/
@@ -0,0 +1,216 @@
+/*
+
+===== latency.c ========================================================
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _SOFTGPIO
+#include "softgpio.h"
+#else
+#include <wiringPi.h>
+#endif
+
+#include "shared.h"
+#include "threads.h"
+#include "fileio.h"
+
+
+typedef struct
+{
+    unsigned int count;
+    unsigned int min;
+    unsigned int max;
+    double sum;
+    unsigned int buckets[LT_BUCKETS];
+} lt_histogram_t;
+
+
+static lt_histogram_t lt_stages[LT_STAGES];
+
+static char *lt_stage_names[LT_STAGES] =
+{
+    "ui buffer", "server queue", "sender queue", "wire", "ack",
+    "receiver queue", "reassembly", "client queue", "ui apply"
+};
+
+
+static int LT_index(unsigned int us)
+{
+    int e;
+
+    for(e=0; (us >> e) >= 2u << LT_SUB_BITS; e++)
+        ;
+    return (e << LT_SUB_BITS) + (us >> e);
+}
+
+/* lowest value that falls into a bucket */
+static unsigned int LT_value(int index)
+{
+    int e;
+
+    if(index < 2 << LT_SUB_BITS)
+        return index;
+    e = (index >> LT_SUB_BITS) - 1;
+    return (unsigned int)(index - (e << LT_SUB_BITS)) << e;
+}
+
+/*
+============
+LT_percentile
+
+  Lowest bucket value at or below which p percent of the samples are
+============
+*/
+static unsigned int LT_percentile(lt_histogram_t *h, double p)
+{
+    double want;
+    double seen;
+    int i;
+
+    if(!h->count)
+        return 0;
+
+    want = h->count * p / 100.0;
+    for(i=0, seen=0; i<LT_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if(seen >= want && h->buckets[i])
+            return LT_value(i);
+    }
+    return h->max;
+}
+
+void LT_record(int stage, unsigned int us)
+{
+    lt_histogram_t *h;
+
+    if(stage < 0 || stage >= LT_STAGES)
+        return;
+
+    h = &lt_stages[stage];
+
+    ThreadLock();
+    if(!h->count || us < h->min)
+        h->min = us;
+    if(us > h->max)
+        h->max = us;
+    h->count++;
+    h->sum += us;
+    h->buckets[LT_index(us)]++;
+    ThreadUnlock();
+}
+
+void LT_since(int stage, unsigned int start)
+{
+    LT_record(stage, micros() - start);
+}
+
+void LT_start(pk_buf_t *pk)
+{
+    pk->stamp = micros() | 1;   /* 0 means untraced */
+}
+
+void LT_mark(pk_buf_t *pk, int stage)
+{
+    unsigned int now;
+
+    if(!pk->stamp)
+        return;
+    now = micros() | 1;
+    LT_record(stage, now - pk->stamp);
+    pk->stamp = now;
+}
+
+void LT_reset(void)
+{
+    ThreadLock();
+    memset(lt_stages, 0, sizeof(lt_stages));
+    ThreadUnlock();
+}
+
+/*
+============
+LT_print
+
+  One line per stage, times in ms. Both ends only see their own
+  stages, run it on each.
+============
+*/
+void LT_print(void)
+{
+    lt_histogram_t *h;
+    int i;
+
+    printf("------------------\n");
+    printf("%-15s %8s %9s %9s %9s %9s %9s\n", "stage", "count", "mean", "p50", "p90", "p99", "max");
+    for(i=0; i<LT_STAGES; i++)
+    {
+        h = &lt_stages[i];
+        if(!h->count)
+            continue;
+        printf("%-15s %8u %9.1f %9.1f %9.1f %9.1f %9.1f\n", lt_stage_names[i], h->count,
+               h->sum / h->count / 1000.0,
+               LT_percentile(h, 50) / 1000.0,
+               LT_percentile(h, 90) / 1000.0,
+               LT_percentile(h, 99) / 1000.0,
+               h->max / 1000.0);
+    }
+    printf("------------------\n");
+}
+
+static void LT_dumped(io_request_t *req)
+{
+    if(req->result < 0)
+        printf("latency: couldn't write %s\n", req->filename);
+}
+
+/*
+============
+LT_dump
+
+  Writes the full distributions in the HdrHistogram percentile output
+  layout, value in ms, percentile, total count, one block per stage.
+  The text is formatted here and written by the file service, a
+  failure is reported when it completes. Returns 0, or -1 if there's
+  no memory for it.
+============
+*/
+int LT_dump(char *filename)
+{
+    io_request_t *req;
+    char *buf, *p;
+    lt_histogram_t *h;
+    unsigned int total;
+    int i, j;
+
+    buf = malloc(LT_STAGES * (128 + LT_BUCKETS * 40));
+    if(!buf)
+        return -1;
+
+    for(i=0, p=buf; i<LT_STAGES; i++)
+    {
+        h = &lt_stages[i];
+        p += sprintf(p, "# stage %s, %u samples, min %.3f ms, max %.3f ms\n",
+                     lt_stage_names[i], h->count, h->min / 1000.0, h->max / 1000.0);
+        p += sprintf(p, "%12s %14s %10s\n", "Value", "Percentile", "TotalCount");
+        for(j=0, total=0; j<LT_BUCKETS; j++)
+        {
+            if(!h->buckets[j])
+                continue;
+            total += h->buckets[j];
+            p += sprintf(p, "%12.3f %14.12f %10u\n", LT_value(j) / 1000.0, (double)total / h->count, total);
+        }
+        p += sprintf(p, "\n");
+    }
+
+    req = IO_save(filename, buf, (int)(p - buf), IO_TRUNCATE | IO_GIVE, LT_dumped, NULL);
+    if(!req)
+        return -1;
+    IO_release(req);
+    return 0;
+}
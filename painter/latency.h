@@ -0,0 +1,66 @@
+/*
+//=============================================================================
+//
+// Purpose: latency histograms for the stages of the stroke pipeline
+//
+// $NoKeywords: $
+//=============================================================================
+*/
+
+
+#ifndef __LATENCY__
+#define __LATENCY__
+
+
+/*
+// latency.h
+*/
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+   A packet buffer carries the micros() time it crossed its last stage
+   boundary, LT_mark records the time since then for the stage it is
+   leaving. Buffers nobody stamped (ACKs) are not traced.
+
+   The histograms are log-linear like HdrHistogram: values below
+   2 << LT_SUB_BITS microseconds are exact, above that every power of
+   two is split into 1 << LT_SUB_BITS buckets, about 3 % apart, up to
+   the full range of an unsigned int.
+*/
+
+/* sending end */
+#define	LT_UI_BUFFER        0   /* line drawn -> packet posted */
+#define	LT_SV_QUEUE         1   /* posted -> taken by the server */
+#define	LT_SD_QUEUE         2   /* handed to the sender -> first bit */
+#define	LT_WIRE             3   /* first bit -> last bit */
+#define	LT_ACK              4   /* handed to the sender -> ACK back */
+/* receiving end */
+#define	LT_RC_QUEUE         5   /* first byte in receiver_buffer -> read by the client */
+#define	LT_CL_REASSEMBLY    6   /* first byte read -> CRC16 checked */
+#define	LT_CL_QUEUE         7   /* delivered -> taken by the consumer */
+#define	LT_UI_APPLY         8   /* taken -> drawn */
+#define	LT_STAGES           9
+
+#define	LT_SUB_BITS         5
+#define	LT_BUCKETS          ((33 - LT_SUB_BITS) << LT_SUB_BITS)
+
+void LT_record(int stage, unsigned int us);
+void LT_since(int stage, unsigned int start);
+void LT_start(pk_buf_t *pk);
+void LT_mark(pk_buf_t *pk, int stage);
+
+void LT_reset(void);
+void LT_print(void);
+int LT_dump(char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /*__LATENCY__*/
@@ -0,0 +1,177 @@
+/*
+
+===== link.c ========================================================
+
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _SOFTGPIO
+#include "softgpio.h"
+#else
+#include <wiringPi.h>
+#endif
+
+#include "shared.h"
+#include "server.h"
+#include "client.h"
+
+
+link_t link_default;
+static link_t *link_table[MAX_LINKS];
+
+
+/*
+============
+LK_init
+
+  Resets a link to the defaults and gives it the pins of link id,
+  which have to be the same on both ends. Set up the configuration
+  before any of its threads start.
+============
+*/
+void LK_init(link_t *l, int id)
+{
+    int base = id * LINK_PINS;
+
+    memset(l, 0, sizeof(*l));
+    l->id = id;
+
+    l->tx = base + TX;
+    l->rx = base + RX;
+    l->tx_strobe = base + TX_STROBE;
+    l->rx_strobe = base + RX_STROBE;
+    l->tx_data = base + TX_DATA;
+    l->rx_data = base + RX_DATA;
+    l->tx_clock = base + TX_CLOCK;
+    l->rx_clock = base + RX_CLOCK;
+    l->rts = base + RTS;
+    l->cts = base + CTS;
+
+    l->mode = LINK_SERIAL;
+#ifdef _MANCHESTER
+    l->coding = CODING_MANCHESTER;
+#else
+    l->coding = CODING_NRZ;
+#endif /*// _MANCHESTER*/
+#ifdef _MSB
+    l->msb = 1;
+#else
+    l->msb = 0;
+#endif  /* _MSB */
+    l->lanes = MAX_LANES;
+    l->clock_half = 100;
+    l->tx_period = BAUD_RATE;
+    l->rx_period = BAUD_RATE;
+    l->gap = LINK_GAP;
+    l->ack_wait = MAX_WAIT_TIMES;
+    l->flow = FLOW_RTSCTS;
+    l->rc_buffer_size = RC_BUFFER_SIZE;
+
+    l->sv_lanes[SV_LANE_CONTROL].size = SV_CONTROL_QUEUE_SIZE;
+    l->sv_lanes[SV_LANE_CONTROL].msgs = l->sv_control_msgs;
+    l->sv_lanes[SV_LANE_DATA].size = SV_QUEUE_SIZE;
+    l->sv_lanes[SV_LANE_DATA].msgs = l->sv_data_msgs;
+    l->sv_next_ticket = 1;
+    l->sv_window = SV_WINDOW;
+
+    if(id >= 0 && id < MAX_LINKS)
+        link_table[id] = l;
+}
+
+/*
+============
+LK_find
+
+  Returns the link LK_init set up with id, or NULL
+============
+*/
+link_t *LK_find(int id)
+{
+    if(id < 0 || id >= MAX_LINKS)
+        return NULL;
+    return link_table[id];
+}
+
+/*
+============
+LK_configure
+
+  Copies the link settings, not the pins or the state
+============
+*/
+void LK_configure(link_t *l, link_t *from)
+{
+    l->mode = from->mode;
+    l->coding = from->coding;
+    l->msb = from->msb;
+    l->lanes = from->lanes;
+    l->clock_half = from->clock_half;
+    l->tx_period = from->tx_period;
+    l->sd_new_period = from->sd_new_period;
+    l->gap = from->gap;
+    l->ack_wait = from->ack_wait;
+    l->flow = from->flow;
+    l->rc_buffer_size = from->rc_buffer_size;
+    l->compress = from->compress;
+    l->sv_window = from->sv_window;
+}
+
+/*
+============
+LK_run
+
+  Thread body for one part of a link, never returns
+============
+*/
+void LK_run(link_t *l, int role)
+{
+    switch(role)
+    {
+        case LK_SENDER : SD_main(l);break;
+        case LK_RECEIVER : RC_main(l);break;
+        case LK_SERVER : SV_main(l);break;
+        case LK_CLIENT : CL_main(l);break;
+    }
+}
+
+typedef struct
+{
+    link_t *l;
+    int role;
+} lk_task_t;
+
+static void LK_task(void *arg)
+{
+    lk_task_t *task = (lk_task_t *)arg;
+
+    LK_run(task->l, task->role);
+}
+
+/*
+============
+LK_run_tasks
+
+  Runs all four parts of a link as tasks on the calling thread,
+  never returns. They only switch where they would have slept, so the
+  timing is the same as with four threads as long as none of them
+  is busy for longer than the shortest bit.
+============
+*/
+void LK_run_tasks(link_t *l)
+{
+    lk_task_t tasks[LK_ROLES];
+    sc_sched_t *s;
+    int i;
+
+    s = SC_create();
+    for(i=0; i<LK_ROLES; i++)
+    {
+        tasks[i].l = l;
+        tasks[i].role = i;
+        SC_spawn(s, LK_task, &tasks[i]);
+    }
+    SC_run(s);
+}
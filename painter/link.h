@@ -0,0 +1,187 @@
+/*
+//=============================================================================
+//
+// Purpose: state of one link, sender, receiver, server and client
+//
+// $NoKeywords: $
+//=============================================================================
+*/
+
+
+#ifndef __LINK__
+#define __LINK__
+
+
+/*
+// link.h
+*/
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+   Every link has its own pins, buffers, queues and flags, so one
+   process can run as many links as it has pins for. Each of the four
+   parts either gets a thread of its own (LK_run) or all four share
+   one as tasks of a scheduler (LK_run_tasks).
+
+   link_default is the link the rest of the program has always talked
+   to. The old globals and the argument-less SD_/RC_/SV_/CL_ calls are
+   kept and work on it.
+*/
+
+#define	LINK_PINS       24  /* pins per link, link n starts at pin n * LINK_PINS */
+#define	MAX_LINKS       48  /* with -fibers, 8 + MAX_LINKS - 1 threads */
+#define	MAX_THREAD_LINKS    10  /* without, 8 + 4 (MAX_THREAD_LINKS - 1) threads */
+
+/* server queue storage, see server.h */
+#define	SV_QUEUE_SIZE           64  /* size must be 2 ^ n */
+#define	SV_CONTROL_QUEUE_SIZE   8   /* size must be 2 ^ n */
+#define	SV_TICKET_HISTORY       256 /* size must be 2 ^ n */
+#define	SV_LANES                2
+
+#define	SV_WINDOW               4   /* packets waiting for their ACK */
+
+#define	SD_PAK_QUEUE            8   /* size must be 2 ^ n */
+#define	CL_MSG_QUEUE            8   /* size must be 2 ^ n */
+
+/* roles for LK_run */
+#define	LK_SENDER       0
+#define	LK_RECEIVER     1
+#define	LK_SERVER       2
+#define	LK_CLIENT       3
+#define	LK_ROLES        4
+
+typedef struct
+{
+    int ticket;
+    pk_buf_t *pk;
+} sv_msg_t;
+
+/* states of a window slot */
+#define	SV_FLIGHT_FREE      0
+#define	SV_FLIGHT_WAIT      1   /* sent, retransmit timer running */
+#define	SV_FLIGHT_ACKED     2
+#define	SV_FLIGHT_TIMEOUT   3
+
+typedef struct
+{
+    int state;
+    int ticket;
+    int resends;
+    int lane;
+    int dropped;        /* lane dropped while in flight, never resent */
+    unsigned int sent;  /* micros() */
+    pk_buf_t *pk;
+    byte crc[2];
+    tm_timer_t timer;
+} sv_flight_t;
+
+typedef struct
+{
+    int size;           /* size must be 2 ^ n */
+    int get_index;
+    int put_index;
+    sv_msg_t *msgs;
+} sv_lane_t;
+
+typedef struct
+{
+    int id;
+
+    /* pins */
+    int tx, rx;
+    int tx_strobe, rx_strobe;
+    int tx_data, rx_data;   /* first of MAX_LANES */
+    int tx_clock, rx_clock;
+    int rts, cts;
+
+    /* configuration, both ends must agree on mode, coding, msb, lanes, clock_half and flow */
+    int mode;
+    int coding;         /* LINK_SERIAL only */
+    int msb;            /* LINK_SERIAL bit order, D7 first if set */
+    int lanes;          /* LINK_PARALLEL, 4 or 8 */
+    int clock_half;     /* LINK_SYNC clock half period in microseconds */
+    int tx_period;      /* LINK_SERIAL bit period in ms, set by SD_period */
+    int rx_period;      /* LINK_SERIAL bit period in ms, measured by the receiver */
+    int gap;            /* LINK_SERIAL idle bit periods after every byte */
+    int ack_wait;       /* retransmit timeout in bit periods, per packet in flight */
+    int flow;
+    int rc_buffer_size;
+    int compress;       /* send payloads LZ compressed where that's shorter, any receiver takes both */
+
+    /* sender */
+    int sd_ready;
+    ring_buffer sd_buffer;
+    int sd_new_period;
+    int sd_strobe;
+    pk_buf_t *sd_paks[SD_PAK_QUEUE];    /* sent whole, before any sd_buffer byte */
+    int sd_pak_get;
+    int sd_pak_put;
+
+    /* receiver */
+    int rc_ready;
+    ring_buffer rc_buffer;
+    int rc_stopped;     /* RTS is LOW */
+    unsigned int *rc_stamps;    /* micros() each rc_buffer byte arrived */
+    unsigned int rc_arrived;    /* of the byte RC_get returned last */
+
+    /* server */
+    int sv_ready;       /* nothing waiting for an ACK */
+    int sv_window;      /* 1 .. SV_WINDOW */
+    int sv_stats_sent;
+    int sv_stats_resent;
+    int sv_stats_failed;
+    int sv_stats_compressed;    /* packets */
+    int sv_stats_saved;         /* payload bytes */
+    sv_lane_t sv_lanes[SV_LANES];
+    sv_msg_t sv_control_msgs[SV_CONTROL_QUEUE_SIZE];
+    sv_msg_t sv_data_msgs[SV_QUEUE_SIZE];
+    int sv_next_ticket;
+    int sv_ticket_id[SV_TICKET_HISTORY];
+    int sv_ticket_state[SV_TICKET_HISTORY];
+    int sv_ticket_resends[SV_TICKET_HISTORY];
+    sv_flight_t sv_flight[SV_WINDOW];
+
+    /* client */
+    int cl_ready;
+    pk_buf_t *cl_msgs[CL_MSG_QUEUE];    /* until the consumer takes them */
+    int cl_msg_get;
+    int cl_msg_put;
+} link_t;
+
+
+extern link_t link_default;
+
+void LK_init(link_t *l, int id);
+void LK_configure(link_t *l, link_t *from);
+link_t *LK_find(int id);
+void LK_run(link_t *l, int role);
+void LK_run_tasks(link_t *l);
+
+/* the single link interface, all on link_default */
+#define	link_mode               (link_default.mode)
+#define	link_coding             (link_default.coding)
+#define	link_lanes              (link_default.lanes)
+#define	link_clock_half         (link_default.clock_half)
+#define	link_tx_period          (link_default.tx_period)
+#define	link_rx_period          (link_default.rx_period)
+#define	link_flow               (link_default.flow)
+#define	receiver_buffer_size    (link_default.rc_buffer_size)
+
+#define	flag_sender_ready       (link_default.sd_ready)
+#define	sender_buffer           (link_default.sd_buffer)
+#define	flag_receiver_ready     (link_default.rc_ready)
+#define	receiver_buffer         (link_default.rc_buffer)
+#define	flag_server_ready       (link_default.sv_ready)
+#define	flag_client_ready       (link_default.cl_ready)
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /*__LINK__*/
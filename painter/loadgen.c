@@ -0,0 +1,211 @@
+/*
+
+===== loadgen.c ========================================================
+
+*/
+
+/*
+   Generates stroke records in the same 4 byte format GlWindow sends
+   (x0, y0, x1, y1; 255,255,255,255 is a clear) and posts them to the
+   server queue at a fixed rate.  Coordinates stay within 1..254 so
+   the records never contain a terminator or a clear by accident.
+
+   A run reports how many strokes were due, how many made it into the
+   queue and how often the queue was full; once the posted rate stops
+   following the requested rate the link is saturated.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _SOFTGPIO
+#include "softgpio.h"
+#else
+#include <wiringPi.h>
+#endif
+
+#include "shared.h"
+#include "server.h"
+
+#include "loadgen.h"
+
+
+typedef struct
+{
+    int active;
+    int pattern;
+    int rate;           /* strokes per second */
+    int count;          /* strokes in total, 0 = until stopped */
+    unsigned int start;
+
+    int generated;
+    int posted;
+    int packets;
+    int stalls;
+    int last_ticket;
+
+    byte x, y;          /* pen position */
+    int hatch;
+} loadgen_t;
+
+
+static loadgen_t lg;
+
+static char *lg_names[] = {"walk", "hatch", "burst", "clear", NULL};
+
+
+static byte LG_clamp(int v)
+{
+    if(v < 1)
+        return 1;
+    if(v > 254)
+        return 254;
+    return (byte)v;
+}
+
+static void LG_next_stroke(byte *rec)
+{
+    switch(lg.pattern)
+    {
+        case LG_WALK :
+        case LG_BURST :
+            rec[0] = lg.x;
+            rec[1] = lg.y;
+            lg.x = LG_clamp(lg.x + rand() % 33 - 16);
+            lg.y = LG_clamp(lg.y + rand() % 33 - 16);
+            rec[2] = lg.x;
+            rec[3] = lg.y;
+            break;
+
+        case LG_HATCH :
+            rec[0] = LG_clamp(1 + lg.hatch);
+            rec[1] = 1;
+            rec[2] = 1;
+            rec[3] = LG_clamp(1 + lg.hatch);
+            lg.hatch = (lg.hatch + 3) % 254;
+            break;
+
+        case LG_CLEAR :
+            rec[0] = rec[1] = rec[2] = rec[3] = 255;
+            break;
+    }
+    lg.generated++;
+}
+
+int LG_start(char *pattern, int rate, int count)
+{
+    int i;
+
+    for(i=0; lg_names[i]; i++)
+        if(!strcmp(pattern, lg_names[i]))
+            break;
+    if(!lg_names[i] || rate <= 0 || count < 0)
+        return -1;
+
+    lg.active = 0;
+    lg.pattern = i;
+    lg.rate = rate;
+    lg.count = count;
+    lg.generated = 0;
+    lg.posted = 0;
+    lg.packets = 0;
+    lg.stalls = 0;
+    lg.last_ticket = 0;
+    lg.x = lg.y = 128;
+    lg.hatch = 0;
+    lg.start = millis();
+    lg.active = 1;
+
+    return 0;
+}
+
+void LG_stop()
+{
+    lg.active = 0;
+}
+
+void LG_print_stats()
+{
+    unsigned int elapsed;
+
+    elapsed = millis() - lg.start;
+    printf("------------------\n");
+    printf("loadgen %s %s, %d strokes/s requested\n", lg_names[lg.pattern], lg.active ? "running" : "stopped", lg.rate);
+    printf("posted = %d strokes in %d packets, %.1f strokes/s\n", lg.posted, lg.packets,
+           elapsed ? lg.posted * 1000.0 / elapsed : 0.0);
+    printf("queue full = %d times, backlog = %d strokes\n", lg.stalls, lg.generated - lg.posted);
+    if(lg.last_ticket)
+        printf("last ticket = %d, server queue = %d\n", lg.last_ticket, SV_queue_length());
+    printf("------------------\n");
+}
+
+void loadgen_main()
+{
+    byte msg[MAX_MSG_LENGTH];
+    int length = 0;
+    int strokes = 0;
+    int ticket;
+    double due;
+
+    for(; !flag_server_ready;)
+        delay(BAUD_RATE);
+
+    for(;;)
+    {
+        if(!lg.active)
+        {
+            length = 0;
+            strokes = 0;
+            delay(BAUD_RATE);
+            continue;
+        }
+
+        if(!length)
+        {
+            if(lg.pattern == LG_BURST)
+                due = (double)((millis() - lg.start) / 1000 + 1) * lg.rate;
+            else
+                due = (double)(millis() - lg.start) * lg.rate / 1000.0;
+            if(lg.count && due > lg.count)
+                due = lg.count;
+
+            for(; lg.generated < due && length + 4 <= MAX_MSG_LENGTH; length += 4, strokes++)
+            {
+                LG_next_stroke(&msg[length]);
+                if(lg.pattern == LG_CLEAR)
+                {
+                    length += 4;
+                    strokes++;
+                    break;      /* a clear travels on its own control lane, like GlWindow::LineClear */
+                }
+            }
+        }
+
+        if(length)
+        {
+            ticket = SV_post_msg_lane(msg, length, lg.pattern == LG_CLEAR ? SV_LANE_CONTROL : SV_LANE_DATA);
+            if(ticket > 0)
+            {
+                lg.last_ticket = ticket;
+                lg.posted += strokes;
+                lg.packets++;
+                length = 0;
+                strokes = 0;
+            }
+            else
+            {
+                lg.stalls++;
+                delay(_SCAN_TIME_SPAN);
+            }
+        }
+        else if(lg.count && lg.posted >= lg.count)
+        {
+            lg.active = 0;
+            printf("Loadgen::run complete\n");
+            LG_print_stats();
+        }
+        else
+            delay(_SCAN_TIME_SPAN);
+    }
+}
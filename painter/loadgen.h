@@ -0,0 +1,41 @@
+/*
+//=============================================================================
+//
+// Purpose: synthetic stroke load for stress testing the link
+//
+// $NoKeywords: $
+//=============================================================================
+*/
+
+
+#ifndef __LOADGEN__
+#define __LOADGEN__
+
+
+/*
+// loadgen.h
+*/
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define	LG_WALK         0   /* random walk, each stroke starts where the last ended */
+#define	LG_HATCH        1   /* dense 45 degree hatching */
+#define	LG_BURST        2   /* random walk, a whole second of strokes at once */
+#define	LG_CLEAR        3   /* clear commands only */
+
+int LG_start(char *pattern, int rate, int count);
+void LG_stop();
+void LG_print_stats();
+
+void loadgen_main();
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /*__LOADGEN__*/
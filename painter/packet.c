@@ -0,0 +1,151 @@
+/*
+
+===== packet.c ========================================================
+
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "shared.h"
+#include "threads.h"
+
+
+static pk_buf_t pk_pool[PK_POOL_SIZE];
+static pk_buf_t *pk_free_list;
+static int pk_initialized;
+static int pk_used;
+static int pk_peak;
+static int pk_failed;
+
+
+/*
+============
+PK_alloc
+
+  Returns an empty buffer with PK_HEADROOM in front and one reference,
+  or NULL if the pool is exhausted
+============
+*/
+pk_buf_t *PK_alloc(void)
+{
+    pk_buf_t *pk;
+    int i;
+
+    ThreadLock();
+    if(!pk_initialized)
+    {
+        for(i=0; i<PK_POOL_SIZE; i++)
+            pk_pool[i].next = i + 1 < PK_POOL_SIZE ? &pk_pool[i+1] : NULL;
+        pk_free_list = pk_pool;
+        pk_initialized = 1;
+    }
+
+    pk = pk_free_list;
+    if(!pk)
+    {
+        pk_failed++;
+        ThreadUnlock();
+        return NULL;
+    }
+    pk_free_list = pk->next;
+    if(++pk_used > pk_peak)
+        pk_peak = pk_used;
+    ThreadUnlock();
+
+    pk->next = NULL;
+    pk->refs = 1;
+    pk->head = PK_HEADROOM;
+    pk->length = 0;
+    pk->stamp = 0;
+    return pk;
+}
+
+pk_buf_t *PK_ref(pk_buf_t *pk)
+{
+    ThreadLock();
+    pk->refs++;
+    ThreadUnlock();
+    return pk;
+}
+
+void PK_free(pk_buf_t *pk)
+{
+    if(!pk)
+        return;
+
+    ThreadLock();
+    if(--pk->refs == 0)
+    {
+        pk->next = pk_free_list;
+        pk_free_list = pk;
+        pk_used--;
+    }
+    ThreadUnlock();
+}
+
+/*
+============
+PK_push
+
+  Grows the buffer by n bytes at the front, returns the first of them
+  or NULL if the head room is used up
+============
+*/
+byte *PK_push(pk_buf_t *pk, int n)
+{
+    if(n > pk->head)
+        return NULL;
+    pk->head -= n;
+    pk->length += n;
+    return PK_data(pk);
+}
+
+/*
+============
+PK_pull
+
+  Strips n bytes from the front, returns the new first byte
+============
+*/
+byte *PK_pull(pk_buf_t *pk, int n)
+{
+    if(n > pk->length)
+        return NULL;
+    pk->head += n;
+    pk->length -= n;
+    return PK_data(pk);
+}
+
+/*
+============
+PK_put
+
+  Grows the buffer by n bytes at the back, returns the first of them
+  or NULL if it doesn't fit
+============
+*/
+byte *PK_put(pk_buf_t *pk, int n)
+{
+    byte *tail;
+
+    if(pk->head + pk->length + n > PK_SIZE)
+        return NULL;
+    tail = PK_data(pk) + pk->length;
+    pk->length += n;
+    return tail;
+}
+
+void PK_trim(pk_buf_t *pk, int length)
+{
+    if(length < pk->length)
+        pk->length = length;
+}
+
+void PK_stats(int *used, int *peak, int *failed)
+{
+    *used = pk_used;
+    *peak = pk_peak;
+    *failed = pk_failed;
+}
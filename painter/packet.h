@@ -0,0 +1,75 @@
+/*
+//=============================================================================
+//
+// Purpose: pooled, reference counted packet buffers
+//
+// $NoKeywords: $
+//=============================================================================
+*/
+
+
+#ifndef __PACKET__
+#define __PACKET__
+
+
+/*
+// packet.h
+*/
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+   A message is written into a packet buffer once, by whoever makes it,
+   and then passed by pointer: server queue, sender, and on the other
+   end client to consumer. The server puts the header in front of the
+   payload and the CRC16 behind it in place, that's what the head and
+   tail room are for.
+
+   Every holder owns one reference and gives it back with PK_free,
+   the last one returns the buffer to the pool. The data must not be
+   changed once a buffer has more than one holder.
+
+   All pool and reference updates take ThreadLock, so none of these
+   may be called while holding it.
+*/
+
+#define	PK_HEADROOM     2   /* |0|length| */
+#define	PK_TAILROOM     2   /* |crc16byte0|crc16byte1| */
+#define	PK_SIZE         (PK_HEADROOM + MAX_MSG_LENGTH + PK_TAILROOM)
+#define	PK_LINK_BUFFERS 96      /* every queue and window slot of a link, and some */
+#define	PK_POOL_SIZE    (MAX_LINKS * PK_LINK_BUFFERS)
+
+typedef struct pk_buf_s
+{
+    int refs;
+    int head;           /* offset of the first byte in data */
+    int length;
+    unsigned int stamp;     /* see latency.h */
+    struct pk_buf_s *next;  /* free list */
+    byte data[PK_SIZE];
+} pk_buf_t;
+
+#define	PK_data(pk)     ((pk)->data + (pk)->head)
+#define	PK_length(pk)   ((pk)->length)
+
+pk_buf_t *PK_alloc(void);
+pk_buf_t *PK_ref(pk_buf_t *pk);
+void PK_free(pk_buf_t *pk);
+
+byte *PK_push(pk_buf_t *pk, int n);
+byte *PK_pull(pk_buf_t *pk, int n);
+byte *PK_put(pk_buf_t *pk, int n);
+void PK_trim(pk_buf_t *pk, int length);
+
+void PK_stats(int *used, int *peak, int *failed);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /*__PACKET__*/
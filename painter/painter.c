@@ -20,15 +20,25 @@
 #include "cmdlib.h"
 #include "threads.h"
 
+#ifdef _SOFTGPIO
+#include "softgpio.h"
+#endif
+
 #include "GlPainter.h"
 #include "shared.h"
 #include "server.h"
 #include "client.h"
 #include "action.h"
+#include "loadgen.h"
+#include "profile.h"
 
 #include "painter.h"
 
 qboolean dumplog = false;
+
+static link_t painter_links[MAX_LINKS - 1];  /* links after link_default */
+static int painter_numlinks = 1;
+static qboolean painter_fibers = false;     /* one thread per link, see LK_run_tasks */
 void WriteLog (char *name)
 {
 	FILE		*out;
@@ -50,7 +60,9 @@ void thread_glpainter()
     printf("start thread_glpainter\n");
 #endif /*// _DEBUG*/
 
+#ifndef _NOGUI
     glpainter_main();
+#endif /*// _NOGUI*/
 
 #ifdef _DEBUG
     printf("thread_glpainter terminated\n");
@@ -134,8 +146,48 @@ void thread_cmd()
 
 }
 
+void thread_loadgen()
+{
+
+#ifdef _DEBUG
+    printf("start thread_loadgen\n");
+#endif /*// _DEBUG*/
+
+    loadgen_main();
+
+#ifdef _DEBUG
+    printf("thread_loadgen terminated\n");
+#endif /*// _DEBUG*/
+
+}
+
+void thread_timer()
+{
+
+#ifdef _DEBUG
+    printf("start thread_timer\n");
+#endif /*// _DEBUG*/
+
+    TM_main();
+
+#ifdef _DEBUG
+    printf("thread_timer terminated\n");
+#endif /*// _DEBUG*/
+
+}
+
 void thread_create(int id)
 {
+    if(painter_fibers)
+    {
+        if(id == 0)
+            LK_run_tasks(&link_default);
+        else if(id >= 8)
+            LK_run_tasks(&painter_links[id - 8]);
+        if(id < 4 || id >= 8)
+            return;
+    }
+
     switch(id)
     {
         case 0 : thread_sender();break;
@@ -144,17 +196,35 @@ void thread_create(int id)
         case 3 : thread_client();break;
         case 4 : thread_cmd();break;
         case 5 : thread_glpainter();break;
+        case 6 : thread_loadgen();break;
+        case 7 : thread_timer();break;
+        default :
+            id -= 8;
+            LK_run(&painter_links[id / LK_ROLES], id % LK_ROLES);
+            break;
     }
 }
 
+#ifdef _SOFTGPIO
+/* -trace, the dump is written on the way out */
+static void painter_trace_stop (void)
+{
+    if (pinTraceActive ())
+        pinTraceStop ();
+}
+#endif
+
 int main( int argc, char **argv )
 {
     int i;
+    int workcnt;
 	double		start, end;
 
 	printf( "painter.exe  (%s)\n", __DATE__ );
 	printf ("----- Painter ----\n");
 
+	LK_init (&link_default, 0);
+
 	verbose = true;  /* Originally FALSE */
 
 	for (i=0 ; i<argc ; i++)
@@ -169,36 +239,201 @@ int main( int argc, char **argv )
 		{
 			verbose = false;
 		}
-		else if (!strcmp(argv[i],"-threads"))
+		else if (!strcmp(argv[i],"-parallel"))
+		{
+			if ( ++i < argc )
+			{
+				link_mode = LINK_PARALLEL;
+				link_lanes = atoi (argv[i]);
+				if ( link_lanes != 4 && link_lanes != 8 )
+				{
+					fprintf(stderr, "Error: expected 4 or 8 after '-parallel'\n" );
+					return 1;
+				}
+			}
+			else
+			{
+				fprintf( stderr, "Error: expected a lane count after '-parallel'\n" );
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[i],"-manchester"))
+		{
+			link_coding = CODING_MANCHESTER;
+		}
+		else if (!strcmp(argv[i],"-nrz"))
+		{
+			link_coding = CODING_NRZ;
+		}
+		else if (!strcmp(argv[i],"-sync"))
+		{
+			if ( ++i < argc )
+			{
+				link_mode = LINK_SYNC;
+				link_clock_half = atoi (argv[i]);
+				if ( link_clock_half < 0 )
+				{
+					fprintf(stderr, "Error: expected a clock half period in microseconds after '-sync'\n" );
+					return 1;
+				}
+			}
+			else
+			{
+				fprintf( stderr, "Error: expected a value after '-sync'\n" );
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[i],"-links"))
+		{
+			if ( ++i < argc )
+			{
+				painter_numlinks = atoi (argv[i]);
+				if ( painter_numlinks < 1 || painter_numlinks > MAX_LINKS )
+				{
+					fprintf(stderr, "Error: expected 1 to %d links after '-links'\n", MAX_LINKS );
+					return 1;
+				}
+			}
+			else
+			{
+				fprintf( stderr, "Error: expected a value after '-links'\n" );
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[i],"-fibers"))
+		{
+			painter_fibers = true;
+		}
+		else if (!strcmp(argv[i],"-window"))
+		{
+			if ( ++i < argc && atoi (argv[i]) >= 1 && atoi (argv[i]) <= SV_WINDOW )
+			{
+				link_default.sv_window = atoi (argv[i]);
+			}
+			else
+			{
+				fprintf( stderr, "Error: expected 1 to %d packets after '-window'\n", SV_WINDOW );
+				return 1;
+			}
+		}
+#ifdef _SOFTGPIO
+		else if (!strcmp(argv[i],"-trace"))
+		{
+			if ( ++i < argc )
+			{
+				pinTraceStart (argv[i]);
+				atexit (painter_trace_stop);
+			}
+			else
+			{
+				fprintf( stderr, "Error: expected a file name after '-trace'\n" );
+				return 1;
+			}
+		}
+#endif
+		else if (!strcmp(argv[i],"-profiles"))
+		{
+			if ( ++i >= argc || LP_load (argv[i]) < 0 )
+			{
+				fprintf( stderr, "Error: expected a profile file after '-profiles'\n" );
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[i],"-profile"))
+		{
+			if ( ++i < argc && LP_find (argv[i]) )
+			{
+				LP_apply (&link_default, LP_find (argv[i]), 0);
+			}
+			else
+			{
+				fprintf( stderr, "Error: expected a profile loaded by '-profiles' after '-profile'\n" );
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[i],"-compress"))
+		{
+			link_default.compress = 1;
+		}
+		else if (!strcmp(argv[i],"-noflow"))
+		{
+			link_flow = FLOW_NONE;
+		}
+		else if (!strcmp(argv[i],"-rcbuffer"))
 		{
 			if ( ++i < argc )
 			{
-				numthreads = atoi (argv[i]);
-				if ( numthreads <= 0 )
+				receiver_buffer_size = atoi (argv[i]);
+				if ( receiver_buffer_size < BUFFER_SIZE || ( receiver_buffer_size & ( receiver_buffer_size - 1 ) ) )
 				{
-					fprintf(stderr, "Error: expected positive value after '-threads'\n" );
+					fprintf(stderr, "Error: receive buffer must be a power of 2 of at least %d bytes\n", BUFFER_SIZE );
 					return 1;
 				}
 			}
 			else
 			{
-				fprintf( stderr, "Error: expected a value after '-threads'\n" );
+				fprintf( stderr, "Error: expected a value after '-rcbuffer'\n" );
 				return 1;
 			}
 		}
+		else if (!strcmp(argv[i],"-baud"))
+		{
+			if ( ++i < argc && atoi (argv[i]) > 0 )
+			{
+				SD_set_period (atoi (argv[i]));
+			}
+			else
+			{
+				fprintf( stderr, "Error: expected a bit period in ms after '-baud'\n" );
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[i],"-loadgen"))
+		{
+			if ( i + 3 < argc )
+			{
+				if ( LG_start (argv[i+1], atoi (argv[i+2]), atoi (argv[i+3])) )
+				{
+					fprintf( stderr, "Error: bad load after '-loadgen'\n" );
+					return 1;
+				}
+				i += 3;
+			}
+			else
+			{
+				fprintf( stderr, "Error: expected <pattern> <rate> <count> after '-loadgen'\n" );
+				return 1;
+			}
+		}
+	}
+
+	if ( !painter_fibers && painter_numlinks > MAX_THREAD_LINKS )
+	{
+		fprintf( stderr, "Error: more than %d links need '-fibers'\n", MAX_THREAD_LINKS );
+		return 1;
 	}
 
 	if (i != argc )
-		Error ("usage: painter [-log] [-threads n] [-verbose] [-terse]");
+		Error ("usage: painter [-log] [-parallel 4|8] [-sync us] [-manchester|-nrz] [-baud ms] [-links n] [-fibers] [-window n] [-trace file.vcd] [-profiles file] [-profile name] [-noflow] [-compress] [-rcbuffer n] [-loadgen pattern rate count] [-verbose] [-terse]");
+
+    /* the other links run with the same settings as link_default */
+    for (i=1 ; i<painter_numlinks ; i++)
+    {
+        LK_init (&painter_links[i-1], i);
+        LK_configure (&painter_links[i-1], &link_default);
+    }
 
-    ThreadSetDefault ();
+    /* with -fibers link n > 0 is thread 7 + n, otherwise threads 8 + 4 (n - 1) .. */
+    workcnt = 8 + (painter_numlinks - 1) * (painter_fibers ? 1 : LK_ROLES);
 
-#ifndef WIN32
-    numthreads = 6;
-#endif /*// WIN32*/
+    /* every work item loops forever, each needs a thread of its own
+       whatever the CPU count, so there is no -threads; MAX_LINKS and
+       MAX_THREAD_LINKS keep this within MAX_THREADS */
+    numthreads = workcnt;
+    qprintf ("%i threads\n", numthreads);
 
 	start = I_FloatTime ();
-	RunThreadsOnIndividual(6, false, thread_create);
+	RunThreadsOnIndividual(workcnt, false, thread_create);
 /*
  //      RunThreadsOn (6, true, thread_create);
  //      RunThreadsOn (6, true, thread_create);
@@ -0,0 +1,58 @@
+/*
+//=============================================================================
+//
+// Purpose: USDT static tracepoints
+//
+// $NoKeywords: $
+//=============================================================================
+*/
+
+
+#ifndef __PROBES__
+#define __PROBES__
+
+
+/*
+// probes.h
+*/
+
+/*
+   Built with -D_USDT on Linux (sys/sdt.h comes with systemtap-sdt-dev)
+   every probe is a single nop plus an ELF note, perf or bpftrace turn
+   it into a breakpoint only while they are attached, e.g.
+
+     bpftrace -e 'usdt:./painter:painter:crc_fail { @[arg0] = count(); }'
+
+   Without _USDT they compile to nothing.
+
+     provider painter       arguments
+     pak_enqueue            link, ticket, length    SV_post_pak
+     tx_start               link, length            SD_main, before the first byte
+     tx_end                 link, length            SD_main, after the last byte
+     rx_byte                link, byte              RC_put
+     crc_fail               link, length            CL_main
+     ack                    link, ticket, us        SV_ack, time since sent
+     resend                 link, ticket, resends   SV_main
+     deliver                link, length            CL_deliver
+     draw_begin             lines                   GlWindow::draw
+     draw_end               lines
+*/
+
+#if defined(_USDT) && !defined(WIN32)
+
+#include <sys/sdt.h>
+
+#define	PR_PROBE1(name, a)          DTRACE_PROBE1(painter, name, a)
+#define	PR_PROBE2(name, a, b)       DTRACE_PROBE2(painter, name, a, b)
+#define	PR_PROBE3(name, a, b, c)    DTRACE_PROBE3(painter, name, a, b, c)
+
+#else
+
+#define	PR_PROBE1(name, a)
+#define	PR_PROBE2(name, a, b)
+#define	PR_PROBE3(name, a, b, c)
+
+#endif /* _USDT */
+
+
+#endif  /*__PROBES__*/
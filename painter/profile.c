@@ -0,0 +1,227 @@
+/*
+
+===== profile.c ========================================================
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shared.h"
+#include "profile.h"
+
+
+static lp_profile_t lp_profiles[LP_MAX_PROFILES];
+static int lp_numprofiles;
+
+
+static void LP_defaults(lp_profile_t *p, char *name)
+{
+    strncpy(p->name, name, LP_NAME_LENGTH - 1);
+    p->name[LP_NAME_LENGTH - 1] = 0;
+    p->period = BAUD_RATE;
+    p->gap = LINK_GAP;
+    p->ack_wait = MAX_WAIT_TIMES;
+    p->window = SV_WINDOW;
+    p->rc_buffer_size = RC_BUFFER_SIZE;
+#ifdef _MSB
+    p->msb = 1;
+#else
+    p->msb = 0;
+#endif  /* _MSB */
+}
+
+/* com_token as a number of at least min, -1 if it isn't one */
+static int LP_number(int min)
+{
+    char *end;
+    long value;
+
+    value = strtol(com_token, &end, 10);
+    if(end == com_token || *end || value < min || value > 0x7fffffff)
+        return -1;
+    return (int)value;
+}
+
+/*
+============
+LP_key
+
+  Sets the key named by key from com_token, returns 0 or -1 if the
+  key or the value is no good
+============
+*/
+static int LP_key(lp_profile_t *p, char *key)
+{
+    if(!strcmp(key, "bitorder"))
+    {
+        if(!strcmp(com_token, "msb"))
+            p->msb = 1;
+        else if(!strcmp(com_token, "lsb"))
+            p->msb = 0;
+        else
+            return -1;
+    }
+    else if(!strcmp(key, "period"))    /* RC_train won't take longer ones */
+        return (p->period = LP_number(1)) < 0 || p->period > BAUD_RATE * 8 ? -1 : 0;
+    else if(!strcmp(key, "gap"))
+        return (p->gap = LP_number(0)) < 0 ? -1 : 0;
+    else if(!strcmp(key, "ackwait"))
+        return (p->ack_wait = LP_number(1)) < 0 ? -1 : 0;
+    else if(!strcmp(key, "window"))
+        return (p->window = LP_number(1)) < 0 || p->window > SV_WINDOW ? -1 : 0;
+    else if(!strcmp(key, "rcbuffer"))
+    {
+        p->rc_buffer_size = LP_number(BUFFER_SIZE);
+        if(p->rc_buffer_size < 0 || (p->rc_buffer_size & (p->rc_buffer_size - 1)))
+            return -1;
+    }
+    else
+        return -1;
+    return 0;
+}
+
+/*
+============
+LP_load
+
+  Adds the profiles of a file, see profile.h; one with the name of a
+  loaded profile replaces it. Returns the number read, or -1 if the
+  file can't be read or has a mistake, and then none are added.
+============
+*/
+int LP_load(char *filename)
+{
+    lp_profile_t loaded[LP_MAX_PROFILES];
+    lp_profile_t *p;
+    char key[32];
+    char *buffer;
+    char *data;
+    int count;
+    int i, j;
+
+    if(FileTime(filename) == -1)
+    {
+        printf("Profile::couldn't open %s\n", filename);
+        return -1;
+    }
+    LoadFile(filename, (void **)&buffer);
+
+    count = 0;
+    for(data = COM_Parse(buffer); data; data = COM_Parse(data))
+    {
+        if(strcmp(com_token, "profile"))
+            goto failed;
+        if(count == LP_MAX_PROFILES || !(data = COM_Parse(data)))
+            goto failed;
+        p = &loaded[count];
+        LP_defaults(p, com_token);
+
+        if(!(data = COM_Parse(data)) || strcmp(com_token, "{"))
+            goto failed;
+        for(;;)
+        {
+            if(!(data = COM_Parse(data)))
+                goto failed;
+            if(!strcmp(com_token, "}"))
+                break;
+            strncpy(key, com_token, sizeof(key) - 1);
+            key[sizeof(key) - 1] = 0;
+            if(!(data = COM_Parse(data)) || LP_key(p, key))
+                goto failed;
+        }
+        count++;
+    }
+    free(buffer);
+
+    for(i=0; i<count; i++)
+    {
+        for(j=0; j<lp_numprofiles && strcmp(lp_profiles[j].name, loaded[i].name); j++)
+            ;
+        if(j == LP_MAX_PROFILES)
+        {
+            printf("Profile::no room for %s, only %d profiles\n", loaded[i].name, LP_MAX_PROFILES);
+            continue;
+        }
+        lp_profiles[j] = loaded[i];
+        if(j == lp_numprofiles)
+            lp_numprofiles++;
+    }
+    return count;
+
+failed:
+    printf("Profile::%s: unexpected '%s' in profile %d\n", filename, *com_token ? com_token : "end of file", count + 1);
+    free(buffer);
+    return -1;
+}
+
+int LP_count(void)
+{
+    return lp_numprofiles;
+}
+
+lp_profile_t *LP_get(int index)
+{
+    if(index < 0 || index >= lp_numprofiles)
+        return NULL;
+    return &lp_profiles[index];
+}
+
+lp_profile_t *LP_find(char *name)
+{
+    int i;
+
+    for(i=0; i<lp_numprofiles; i++)
+        if(!strcmp(lp_profiles[i].name, name))
+            return &lp_profiles[i];
+    return NULL;
+}
+
+/*
+============
+LP_apply
+
+  Puts a profile's settings on a link. Before the link runs (running
+  0) that is all of them; on a running one everything but the bit
+  period, which the caller hands to SD_period, and it fails with -1
+  if the profile wants another bit order or receive buffer.
+============
+*/
+int LP_apply(link_t *l, lp_profile_t *p, int running)
+{
+    if(running && (p->msb != l->msb || p->rc_buffer_size != l->rc_buffer_size))
+    {
+        printf("Profile::%s needs another bit order or receive buffer, use -profile on both ends\n", p->name);
+        return -1;
+    }
+
+    l->gap = p->gap;
+    l->ack_wait = p->ack_wait;
+    l->sv_window = p->window;
+    if(!running)
+    {
+        l->msb = p->msb;
+        l->rc_buffer_size = p->rc_buffer_size;
+        l->tx_period = p->period;
+        l->rx_period = p->period;
+    }
+    return 0;
+}
+
+void LP_print(void)
+{
+    lp_profile_t *p;
+    int i;
+
+    printf("------------------\n");
+    printf("%-16s %6s %4s %7s %6s %8s %8s\n", "profile", "period", "gap", "ackwait", "window", "rcbuffer", "bitorder");
+    for(i=0; i<lp_numprofiles; i++)
+    {
+        p = &lp_profiles[i];
+        printf("%-16s %6d %4d %7d %6d %8d %8s\n", p->name, p->period, p->gap, p->ack_wait,
+               p->window, p->rc_buffer_size, p->msb ? "msb" : "lsb");
+    }
+    printf("------------------\n");
+}
@@ -0,0 +1,75 @@
+/*
+//=============================================================================
+//
+// Purpose: named link profiles, loaded at runtime
+//
+// $NoKeywords: $
+//=============================================================================
+*/
+
+
+#ifndef __PROFILE__
+#define __PROFILE__
+
+
+/*
+// profile.h
+*/
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+   A profile file holds any number of
+
+     // comment
+     profile slow
+     {
+         period 50      // bit period, ms
+         gap 11         // idle bit periods after every byte
+         ackwait 418    // retransmit timeout, bit periods per packet in flight
+         window 4       // packets in flight, 1 .. SV_WINDOW
+         rcbuffer 256   // receive buffer, power of 2
+         bitorder lsb   // or msb
+     }
+
+   Keys left out keep the built in defaults, those of the _SLOW,
+   _SLOWX2 and _MSB builds are still what a link starts with.
+
+   Bit order and receive buffer can only be set before the link runs,
+   and the bit order the same on both ends. The bit period is set on
+   a running link through SD_period, the peer's receiver learns it
+   from the training sequence, which takes at most 8 * BAUD_RATE;
+   see TN_profile.
+*/
+
+#define	LP_MAX_PROFILES     16
+#define	LP_NAME_LENGTH      32
+
+typedef struct
+{
+    char name[LP_NAME_LENGTH];
+    int period;
+    int gap;
+    int ack_wait;
+    int window;
+    int rc_buffer_size;
+    int msb;
+} lp_profile_t;
+
+int LP_load(char *filename);
+int LP_count(void);
+lp_profile_t *LP_get(int index);
+lp_profile_t *LP_find(char *name);
+int LP_apply(link_t *l, lp_profile_t *p, int running);
+void LP_print(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /*__PROFILE__*/
@@ -6,6 +6,7 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "buffer.h"
 
@@ -16,65 +17,160 @@
 #endif
 
 #include "shared.h"
+#include "probes.h"
 
 
-int flag_receiver_ready;
-ring_buffer receiver_buffer;
-static byte elem;
+#define	RC_SCAN_TIME_SPAN(l)    ((l)->rx_period / 10 > 0 ? (l)->rx_period / 10 : 1)
+#define	RC_STROBE_SCAN_US       500 /* twice per shortest tx_period, 1 ms */
+
+
+/*
+============
+RC_flow_resume
+
+  Raises RTS again once the consumer has drained the buffer to half.
+  Only called from the consumer side, RC_put is the only place that
+  lowers it.
+============
+*/
+static void RC_flow_resume(link_t *l)
+{
+    if(l->rc_stopped && buffer_count(&l->rc_buffer) <= l->rc_buffer.size / 2)
+    {
+        l->rc_stopped = 0;
+        digitalWrite(l->rts, HIGH);
+    }
+}
+
+/*
+============
+RC_put
+
+  Stores a received byte; with RTS/CTS the peer is told to hold off
+  while RC_FLOW_MARGIN bytes of room are still left for whatever it
+  already had on the wire.
+============
+*/
+static void RC_put(link_t *l, byte *elem)
+{
+    l->rc_stamps[l->rc_buffer.put_index & (l->rc_buffer.size - 1)] = micros();
+    buffer_put(&l->rc_buffer, elem);
+    PR_PROBE2(rx_byte, l->id, *elem);
+    if(l->flow == FLOW_RTSCTS && !l->rc_stopped &&
+       l->rc_buffer.size - buffer_count(&l->rc_buffer) <= RC_FLOW_MARGIN)
+    {
+        digitalWrite(l->rts, LOW);
+        l->rc_stopped = 1;
+    }
+}
 
 
 #ifdef _DEBUG
-byte RC_buffer_get()    /*function may block process */
+byte RC_get(link_t *l)    /*function may block process */
 {
     byte elem;
-    if(!buffer_empty(&receiver_buffer))
-        buffer_get(&receiver_buffer, &elem);
+    if(!buffer_empty(&l->rc_buffer))
+    {
+        l->rc_arrived = l->rc_stamps[l->rc_buffer.get_index & (l->rc_buffer.size - 1)];
+        buffer_get(&l->rc_buffer, &elem);
+    }
     else
     {
         printf("Receiver::buffer is empty, please wait...\n");
-        for(;buffer_empty(&receiver_buffer);)
+        for(;buffer_empty(&l->rc_buffer);)
+        {
+            RC_flow_resume(l);
             delay(BAUD_RATE);
-        buffer_get(&receiver_buffer, &elem);
+        }
+        l->rc_arrived = l->rc_stamps[l->rc_buffer.get_index & (l->rc_buffer.size - 1)];
+        buffer_get(&l->rc_buffer, &elem);
     }
+    RC_flow_resume(l);
     return elem;
 }
 #else
-byte RC_buffer_get()
+byte RC_get(link_t *l)
 {
     byte elem;
-    for(;buffer_empty(&receiver_buffer);)
+    for(;buffer_empty(&l->rc_buffer);)
+    {
+        RC_flow_resume(l);
         delay(BAUD_RATE);
-    buffer_get(&receiver_buffer, &elem);
+    }
+    l->rc_arrived = l->rc_stamps[l->rc_buffer.get_index & (l->rc_buffer.size - 1)];
+    buffer_get(&l->rc_buffer, &elem);
+    RC_flow_resume(l);
     return elem;
 }
 #endif /*// _DEBUG*/
 
-void RC_print_buffer()
+void RC_print(link_t *l)
 {
     printf("------------------\n");
-    buffer_print(&receiver_buffer);
-    buffer_display(&receiver_buffer);
+    buffer_print(&l->rc_buffer);
+    buffer_display(&l->rc_buffer);
     printf("------------------\n");
 }
 
+void RC_flush(link_t *l)
+{
+    buffer_flush(&l->rc_buffer);
+    RC_flow_resume(l);
+}
+
+byte RC_buffer_get()
+{
+    return RC_get(&link_default);
+}
+
+void RC_print_buffer()
+{
+    RC_print(&link_default);
+}
+
 void RC_flush_buffer()
 {
-    buffer_flush(&receiver_buffer);
+    RC_flush(&link_default);
 }
 
-void receiver_init()
+static void RC_init(link_t *l)
 {
+    int i;
+
     wiringPiSetup();
-    pinMode(RX, INPUT);
+    pinMode(l->rx, INPUT);
+
+    if(l->mode == LINK_PARALLEL)
+    {
+        for(i=0; i<l->lanes; i++)
+            pinMode(l->rx_data + i, INPUT);
+        pinMode(l->rx_strobe, INPUT);
+    }
+    else if(l->mode == LINK_SYNC)
+        pinMode(l->rx_clock, INPUT);
+
+    if(l->flow == FLOW_RTSCTS)
+    {
+        pinMode(l->rts, OUTPUT);
+        digitalWrite(l->rts, HIGH);
+    }
 
 #ifdef _DEBUG
     printf("Receiver::GPIO RX is ready\n");
 #endif /*// _DEBUG*/
 
-    buffer_init(&receiver_buffer, BUFFER_SIZE);
-    for(; !digitalRead(RX);)
-        delay(BAUD_RATE);
-    flag_receiver_ready = 1;
+    buffer_init(&l->rc_buffer, l->rc_buffer_size);
+    l->rc_stamps = (unsigned int *)calloc(l->rc_buffer_size, sizeof(unsigned int));
+    if(l->mode == LINK_PARALLEL)
+        for(; digitalRead(l->rx_strobe);)  /* idle strobe is LOW */
+            delay(BAUD_RATE);
+    else if(l->mode == LINK_SYNC)
+        for(; digitalRead(l->rx_clock);)   /* idle clock is LOW */
+            delay(BAUD_RATE);
+    else
+        for(; !digitalRead(l->rx);)
+            delay(BAUD_RATE);
+    l->rc_ready = 1;
 
 #ifdef _DEBUG
     printf("Receiver::receiver is ready\n");
@@ -82,129 +178,296 @@ void receiver_init()
 
 }
 
-void receiver_main()
+/*
+============
+RC_receive_parallel
+
+  Reads the data pins on every strobe edge, see SD_send_parallel.
+  The sender's period can change without notice, so the strobe is
+  polled fast enough for any of them.
+============
+*/
+static void RC_receive_parallel(link_t *l)
 {
+    byte elem;
+    int last = LOW;
+    int level;
+    int word;
+    int i;
+
+    for(;;)
+    {
+        level = digitalRead(l->rx_strobe);
+        if(level == last)
+        {
+            delayMicroseconds(RC_STROBE_SCAN_US);
+            continue;
+        }
+        last = level;
+
+        for(i=0, word=0; i<l->lanes; i++)
+            word |= digitalRead(l->rx_data + i) << i;
+
+        if(l->lanes == 8)
+        {
+            elem = word;
+            RC_put(l, &elem);
+        }
+        else if(level)
+            elem = word;            /* low nibble */
+        else
+        {
+            elem |= word << 4;      /* high nibble */
+            RC_put(l, &elem);
+        }
+    }
+}
 
-    receiver_init();
+/*
+============
+RC_receive_sync
+
+  Samples RX on every rising edge of RX_CLOCK, see SD_send_sync.
+  A frame without its stop bit is dropped and the receiver hunts
+  for the next start bit.
+============
+*/
+static void RC_receive_sync(link_t *l)
+{
+    byte elem = 0;
+    int last = LOW;
+    int level;
+    int bit;
+    int count = -1;
 
     for(;;)
     {
-        if(digitalRead(RX))     /* stop bit */
+        level = digitalRead(l->rx_clock);
+        if(level == last)
         {
-            for(; digitalRead(RX);)
-                delay(_SCAN_TIME_SPAN);
+            delayMicroseconds(l->clock_half / 2);
+            continue;
+        }
+        last = level;
+        if(!level)
+            continue;
 
-#ifdef _DEBUG
-            printf("Receiver::receiving...\n");
-#endif /*// _DEBUG*/
+        bit = digitalRead(l->rx);
+        if(count < 0)
+        {
+            if(!bit)            /* start bit */
+            {
+                elem = 0;
+                count = 0;
+            }
+        }
+        else if(count < 8)
+            elem |= bit << count++;
+        else
+        {
+            if(bit)             /* stop bit */
+                RC_put(l, &elem);
+            count = -1;
+        }
+    }
+}
+
+/*
+============
+RC_wait_until
 
-            delay(BAUD_RATE + BAUD_RATE/2);
+  Sample times are counted from the start edge, see SD_wait_until
+============
+*/
+static void RC_wait_until(unsigned int *due, int ms)
+{
+    unsigned int now;
 
-#ifdef _MSB
+    *due += ms;
+    now = millis();
+    if((int)(*due - now) > 0)
+        delay(*due - now);
+}
 
-            if(digitalRead(RX))
-                elem |= 1 << 7;
-            else
-                elem |= 0 << 7;
-            delay(BAUD_RATE);
+/*
+============
+RC_wait_high
 
-            if(digitalRead(RX))
-                elem |= 1 << 6;
-            else
-                elem |= 0 << 6;
-            delay(BAUD_RATE);
+  Waits for the line to go HIGH, returns ms since start
+============
+*/
+static unsigned int RC_wait_high(link_t *l, unsigned int start)
+{
+    for(; !digitalRead(l->rx);)
+        delay(RC_SCAN_TIME_SPAN(l));
+    return millis() - start;
+}
 
-            if(digitalRead(RX))
-                elem |= 1 << 5;
-            else
-                elem |= 0 << 5;
-            delay(BAUD_RATE);
+/*
+============
+RC_train
+
+  Called after a break, see SD_train. Times the sync byte
+  |0|1|0|1|0|1|0|1|0|1| from its first to its fifth falling edge,
+  which is 8 bits at the sender's new period, and takes that as the
+  receiver's bit period. Polls every ms since the period is unknown.
+============
+*/
+static void RC_train(link_t *l)
+{
+    unsigned int edge[5];
+    int period;
+    int i;
+
+    for(; digitalRead(l->rx);)
+        delay(1);
+    edge[0] = millis();
+    for(i=1; i<5; i++)
+    {
+        for(; !digitalRead(l->rx);)
+            delay(1);
+        for(; digitalRead(l->rx);)
+            delay(1);
+        edge[i] = millis();
+    }
+    period = (edge[4] - edge[0] + 4) / 8;
 
-            if(digitalRead(RX))
-                elem |= 1 << 4;
-            else
-                elem |= 0 << 4;
-            delay(BAUD_RATE);
+    for(; !digitalRead(l->rx);)    /* last data bit, then stop bit */
+        delay(1);
 
-            if(digitalRead(RX))
-                elem |= 1 << 3;
-            else
-                elem |= 0 << 3;
-            delay(BAUD_RATE);
+    /* falling edges are 2 bits apart, anything else wasn't a clean sync byte */
+    for(i=1; i<5; i++)
+        if(edge[i] - edge[i-1] < (unsigned int)period || edge[i] - edge[i-1] > (unsigned int)period * 3)
+            period = 0;
 
-            if(digitalRead(RX))
-                elem |= 1 << 2;
-            else
-                elem |= 0 << 2;
-            delay(BAUD_RATE);
+    if(period > 0 && period <= BAUD_RATE * 8)
+        l->rx_period = period;
+#ifdef _DEBUG
+    else
+        printf("Receiver::bad sync byte\n");
+#endif /*// _DEBUG*/
 
-            if(digitalRead(RX))
-                elem |= 1 << 1;
-            else
-                elem |= 0 << 1;
-            delay(BAUD_RATE);
+#ifdef _DEBUG
+    printf("Receiver::bit period is %d ms\n", l->rx_period);
+#endif /*// _DEBUG*/
+}
 
-            if(digitalRead(RX))
-                elem |= 1;
-            else
-                elem |= 0;
-            delay(BAUD_RATE);
-#else
-            if(digitalRead(RX))
-                elem |= 1;
-            else
-                elem |= 0;
-            delay(BAUD_RATE);
+/*
+============
+RC_receive_manchester
+
+  Clock recovery for SD_send_manchester: every mid-bit edge re-anchors
+  the bit clock, so sender and receiver timing only have to agree to
+  within a quarter bit per bit instead of over the whole frame.
+  After an edge, anything in the next 3/4 bit is a boundary transition
+  and is skipped; the edge after that is the next mid-bit edge and the
+  level it leaves behind is the bit. No edge within 1 1/2 bit is a
+  frame error and the receiver hunts for the next start bit.
+============
+*/
+static void RC_receive_manchester(link_t *l)
+{
+    byte elem;
+    unsigned int edge;
+    unsigned int elapsed;
+    int level;
+    int bit;
+    int i;
 
-            if(digitalRead(RX))
-                elem |= 1 << 1;
-            else
-                elem |= 0 << 1;
-            delay(BAUD_RATE);
+    for(;;)
+    {
+        if(RC_wait_high(l, millis()) >= (unsigned int)l->rx_period * 2)
+            RC_train(l);             /* no valid symbol stays LOW that long */
+        for(; digitalRead(l->rx);)     /* middle of the start bit */
+            delay(RC_SCAN_TIME_SPAN(l));
+        edge = millis();
 
-            if(digitalRead(RX))
-                elem |= 1 << 2;
-            else
-                elem |= 0 << 2;
-            delay(BAUD_RATE);
+#ifdef _DEBUG
+        printf("Receiver::receiving...\n");
+#endif /*// _DEBUG*/
 
-            if(digitalRead(RX))
-                elem |= 1 << 3;
-            else
-                elem |= 0 << 3;
-            delay(BAUD_RATE);
+        elem = 0;
+        for(i=0; i<8; i++)
+        {
+            elapsed = millis() - edge;
+            if(elapsed < (unsigned int)l->rx_period * 3 / 4)
+                delay(l->rx_period * 3 / 4 - elapsed);
+
+            level = digitalRead(l->rx);
+            for(; digitalRead(l->rx) == level && millis() - edge < (unsigned int)l->rx_period * 3 / 2;)
+                delay(RC_SCAN_TIME_SPAN(l));
+            if(digitalRead(l->rx) == level)
+                break;
+            edge = millis();
+
+            bit = !level;
+            elem |= bit << (l->msb ? 7 - i : i);
+        }
 
-            if(digitalRead(RX))
-                elem |= 1 << 4;
-            else
-                elem |= 0 << 4;
-            delay(BAUD_RATE);
+        if(i == 8)
+            RC_put(l, &elem);
+#ifdef _DEBUG
+        else
+            printf("Receiver::manchester frame error\n");
+#endif /*// _DEBUG*/
+    }
+}
 
-            if(digitalRead(RX))
-                elem |= 1 << 5;
-            else
-                elem |= 0 << 5;
-            delay(BAUD_RATE);
+void RC_main(link_t *l)
+{
+    byte elem = 0;
+    unsigned int start;
+    unsigned int due;
+    int i;
 
-            if(digitalRead(RX))
-                elem |= 1 << 6;
-            else
-                elem |= 0 << 6;
-            delay(BAUD_RATE);
+    RC_init(l);
 
-            if(digitalRead(RX))
-                elem |= 1 << 7;
-            else
-                elem |= 0 << 7;
-            delay(BAUD_RATE);
-#endif  /* _MSB */
+    if(l->mode == LINK_PARALLEL)
+        RC_receive_parallel(l);
+    else if(l->mode == LINK_SYNC)
+        RC_receive_sync(l);
+    else if(l->coding == CODING_MANCHESTER)
+        RC_receive_manchester(l);
 
-            buffer_put(&receiver_buffer, &elem);
+    for(;;)
+    {
+        if(digitalRead(l->rx))     /* stop bit */
+        {
+            for(; digitalRead(l->rx);)
+                delay(RC_SCAN_TIME_SPAN(l));
+            start = millis();
+
+#ifdef _DEBUG
+            printf("Receiver::receiving...\n");
+#endif /*// _DEBUG*/
+
+            due = start;
+            RC_wait_until(&due, l->rx_period + l->rx_period/2);
+
+            for(i=0; i<8; i++)
+            {
+                if(digitalRead(l->rx))
+                    elem |= 1 << (l->msb ? 7 - i : i);
+                RC_wait_until(&due, l->rx_period);
+            }
+
+            if(digitalRead(l->rx))
+                RC_put(l, &elem);
+            else if(RC_wait_high(l, start) >= (unsigned int)l->rx_period * (LINK_BREAK_BITS - 3))
+                RC_train(l);
+#ifdef _DEBUG
+            else
+                printf("Receiver::framing error\n");
+#endif /*// _DEBUG*/
             elem = 0;
         }
         else
-            delay(BAUD_RATE);
+            delay(l->rx_period);
     }
 
 }
 
+void receiver_main()
+{
+    RC_main(&link_default);
+}
@@ -0,0 +1,325 @@
+/*
+
+===== scheduler.c ========================================================
+
+*/
+
+
+#ifdef WIN32
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0501     /* ConvertFiberToThread */
+#endif
+#include <windows.h>
+#else
+#define _XOPEN_SOURCE 600       /* ucontext */
+#include <ucontext.h>
+#include <pthread.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _SOFTGPIO
+#include "softgpio.h"
+#else
+#include <wiringPi.h>
+#endif
+
+#include "cmdlib.h"
+#include "threads.h"
+
+#include "scheduler.h"
+
+
+struct sc_task_s
+{
+    sc_func_t func;
+    void *arg;
+    unsigned int wake;  /* micros() */
+    int done;
+#ifdef WIN32
+    LPVOID fiber;
+#else
+    ucontext_t context;
+    void *stack;
+#endif
+};
+
+struct sc_sched_s
+{
+    int running;
+#ifdef WIN32
+    DWORD owner;
+    LPVOID fiber;
+#else
+    pthread_t owner;
+    ucontext_t context;
+#endif
+    sc_task_t tasks[SC_MAX_TASKS];
+    int numtasks;
+    int current;        /* -1 while the scheduler itself runs */
+};
+
+
+static sc_sched_t sc_scheds[SC_MAX_SCHEDULERS];
+static int sc_numscheds;
+
+
+/*
+============
+SC_current
+
+  The scheduler running on this thread, or NULL
+============
+*/
+static sc_sched_t *SC_current(void)
+{
+    sc_sched_t *s;
+    int i;
+
+    for(i=0; i<sc_numscheds; i++)
+    {
+        s = &sc_scheds[i];
+        if(!s->running)
+            continue;
+#ifdef WIN32
+        if(s->owner == GetCurrentThreadId())
+            return s;
+#else
+        if(pthread_equal(s->owner, pthread_self()))
+            return s;
+#endif
+    }
+    return NULL;
+}
+
+static void SC_switch_out(sc_sched_t *s)
+{
+#ifdef WIN32
+    SwitchToFiber(s->fiber);
+#else
+    swapcontext(&s->tasks[s->current].context, &s->context);
+#endif
+}
+
+static void SC_switch_in(sc_sched_t *s, int task)
+{
+    s->current = task;
+#ifdef WIN32
+    SwitchToFiber(s->tasks[task].fiber);
+#else
+    swapcontext(&s->context, &s->tasks[task].context);
+#endif
+    s->current = -1;
+}
+
+/*
+============
+SC_task_main
+
+  First frame of every task. A task that returns is marked done and
+  never resumed; its fiber must not return on Win32, that would end
+  the thread.
+============
+*/
+static void SC_task_main(void)
+{
+    sc_sched_t *s = SC_current();
+    sc_task_t *t = &s->tasks[s->current];
+
+    t->func(t->arg);
+    t->done = 1;
+    SC_switch_out(s);
+}
+
+#ifdef WIN32
+static VOID CALLBACK SC_entry(LPVOID param)
+{
+    SC_task_main();
+}
+#else
+static void SC_entry(void)
+{
+    SC_task_main();
+}
+#endif
+
+/*
+============
+SC_create
+
+  Returns a scheduler with no tasks, Error()s if all are taken
+============
+*/
+sc_sched_t *SC_create(void)
+{
+    sc_sched_t *s;
+
+    ThreadLock();
+    if(sc_numscheds == SC_MAX_SCHEDULERS)
+    {
+        ThreadUnlock();
+        Error("SC_create: too many schedulers");
+    }
+    s = &sc_scheds[sc_numscheds++];
+    ThreadUnlock();
+
+    memset(s, 0, sizeof(*s));
+    s->current = -1;
+    return s;
+}
+
+/*
+============
+SC_spawn
+
+  Adds a task, it starts with the next SC_run. Returns its index,
+  or -1 if the scheduler is full.
+============
+*/
+int SC_spawn(sc_sched_t *s, sc_func_t func, void *arg)
+{
+    sc_task_t *t;
+
+    if(s->numtasks == SC_MAX_TASKS)
+        return -1;
+
+    t = &s->tasks[s->numtasks];
+    t->func = func;
+    t->arg = arg;
+    t->done = 0;
+
+#ifdef WIN32
+    t->fiber = CreateFiber(SC_STACK_SIZE, SC_entry, NULL);
+    if(!t->fiber)
+        Error("SC_spawn: CreateFiber failed");
+#else
+    t->stack = malloc(SC_STACK_SIZE);
+    if(!t->stack)
+        Error("SC_spawn: out of memory");
+    getcontext(&t->context);
+    t->context.uc_stack.ss_sp = t->stack;
+    t->context.uc_stack.ss_size = SC_STACK_SIZE;
+    t->context.uc_link = &s->context;
+    makecontext(&t->context, SC_entry, 0);
+#endif
+
+    return s->numtasks++;
+}
+
+/*
+============
+SC_run
+
+  Runs the tasks on the calling thread until all of them have
+  returned. Always resumes the task that has been due the longest;
+  when none is due the thread sleeps until the first one is.
+============
+*/
+void SC_run(sc_sched_t *s)
+{
+    sc_task_t *t;
+    unsigned int now;
+    int wait;
+    int best;
+    int i;
+
+#ifdef WIN32
+    s->owner = GetCurrentThreadId();
+    s->fiber = ConvertThreadToFiber(NULL);
+    if(!s->fiber)
+        Error("SC_run: ConvertThreadToFiber failed");
+#else
+    s->owner = pthread_self();
+#endif
+    s->running = 1;
+
+    now = micros();
+    for(i=0; i<s->numtasks; i++)
+        s->tasks[i].wake = now;
+
+    for(;;)
+    {
+        best = -1;
+        for(i=0; i<s->numtasks; i++)
+        {
+            t = &s->tasks[i];
+            if(t->done)
+                continue;
+            if(best < 0 || (int)(t->wake - s->tasks[best].wake) < 0)
+                best = i;
+        }
+        if(best < 0)
+            break;
+
+        wait = (int)(s->tasks[best].wake - micros());
+        if(wait > 0)
+        {
+            delayMicroseconds(wait);
+            continue;
+        }
+
+        SC_switch_in(s, best);
+    }
+
+    s->running = 0;
+
+    for(i=0; i<s->numtasks; i++)
+    {
+#ifdef WIN32
+        DeleteFiber(s->tasks[i].fiber);
+#else
+        free(s->tasks[i].stack);
+#endif
+    }
+    s->numtasks = 0;
+
+#ifdef WIN32
+    ConvertFiberToThread();
+#endif
+}
+
+/*
+============
+SC_delay_us
+
+  Inside a task: lets the other tasks run for at least us
+  microseconds. Anywhere else: delayMicroseconds.
+============
+*/
+void SC_delay_us(unsigned int us)
+{
+    sc_sched_t *s = SC_current();
+
+    if(!s || s->current < 0)
+    {
+        delayMicroseconds(us);
+        return;
+    }
+
+    s->tasks[s->current].wake = micros() + us;
+    SC_switch_out(s);
+}
+
+void SC_delay(unsigned int ms)
+{
+    if(!SC_in_task())
+    {
+        delay(ms);
+        return;
+    }
+    SC_delay_us(ms * 1000);
+}
+
+void SC_yield(void)
+{
+    SC_delay_us(0);
+}
+
+int SC_in_task(void)
+{
+    sc_sched_t *s = SC_current();
+
+    return s && s->current >= 0;
+}
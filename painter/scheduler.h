@@ -0,0 +1,62 @@
+/*
+//=============================================================================
+//
+// Purpose: cooperative tasks, many on one thread
+//
+// $NoKeywords: $
+//=============================================================================
+*/
+
+
+#ifndef __SCHEDULER__
+#define __SCHEDULER__
+
+
+/*
+// scheduler.h
+*/
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+   Stackful tasks: Win32 fibers, ucontext elsewhere. A task gives up
+   the thread only in SC_delay, SC_delay_us and SC_yield, so nothing
+   it does between two of those can be interrupted by another task on
+   the same thread.
+
+   The scheduler always resumes the ready task whose deadline is the
+   oldest and sleeps the thread while no task is ready.
+
+   SC_delay and SC_delay_us behave like delay and delayMicroseconds
+   when they are called outside a task, so code can use them without
+   knowing how it is being run.
+*/
+
+#define	SC_MAX_TASKS        8
+#define	SC_MAX_SCHEDULERS   16
+#define	SC_STACK_SIZE       0x10000
+
+typedef void (*sc_func_t)(void *arg);
+
+typedef struct sc_task_s sc_task_t;
+typedef struct sc_sched_s sc_sched_t;
+
+sc_sched_t *SC_create(void);
+int SC_spawn(sc_sched_t *s, sc_func_t func, void *arg);
+void SC_run(sc_sched_t *s);
+
+void SC_delay(unsigned int ms);
+void SC_delay_us(unsigned int us);
+void SC_yield(void);
+int SC_in_task(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /*__SCHEDULER__*/
@@ -16,62 +16,172 @@
 #endif
 
 #include "shared.h"
-
-
-int flag_sender_ready;
-ring_buffer sender_buffer;
-static byte elem;
+#include "threads.h"
+#include "probes.h"
 
 
 #ifdef _DEBUG
-void SD_buffer_put(byte elem)   /*function may block process */
+void SD_put(link_t *l, byte elem)   /*function may block process */
 {
-    if(!buffer_full(&sender_buffer))
-        buffer_put(&sender_buffer, &elem);
+    if(!buffer_full(&l->sd_buffer))
+        buffer_put(&l->sd_buffer, &elem);
     else
     {
         printf("Sender::buffer is full, please wait...\n");
-        for(;buffer_full(&sender_buffer);)
+        for(;buffer_full(&l->sd_buffer);)
             delay(BAUD_RATE);
-        buffer_put(&sender_buffer, &elem);
+        buffer_put(&l->sd_buffer, &elem);
     }
 }
 #else
-void SD_buffer_put(byte elem)
+void SD_put(link_t *l, byte elem)
 {
-    for(;buffer_full(&sender_buffer);)
+    for(;buffer_full(&l->sd_buffer);)
         delay(BAUD_RATE);
-    buffer_put(&sender_buffer, &elem);
+    buffer_put(&l->sd_buffer, &elem);
 }
 #endif /*// _DEBUG*/
 
-void SD_print_buffer()
+/*
+============
+SD_send
+
+  Queues a whole packet, sent straight from its buffer. Takes a
+  reference of its own, so the caller may free or resend pk at once.
+  Blocks while the queue is full.
+============
+*/
+void SD_send(link_t *l, pk_buf_t *pk)
+{
+    PK_ref(pk);
+    for(;;)
+    {
+        ThreadLock();
+        if(l->sd_pak_put - l->sd_pak_get < SD_PAK_QUEUE)
+        {
+            l->sd_paks[l->sd_pak_put & (SD_PAK_QUEUE - 1)] = pk;
+            l->sd_pak_put++;
+            ThreadUnlock();
+            return;
+        }
+        ThreadUnlock();
+        delay(BAUD_RATE);
+    }
+}
+
+/* bytes and packets still to go */
+int SD_queued(link_t *l)
+{
+    return buffer_count(&l->sd_buffer) + l->sd_pak_put - l->sd_pak_get;
+}
+
+void SD_print(link_t *l)
 {
     printf("------------------\n");
-    buffer_print(&sender_buffer);
-    buffer_display(&sender_buffer);
+    buffer_print(&l->sd_buffer);
+    buffer_display(&l->sd_buffer);
     printf("------------------\n");
 }
 
+void SD_flush(link_t *l)
+{
+    pk_buf_t *pk;
+
+    buffer_flush(&l->sd_buffer);
+    for(;;)
+    {
+        ThreadLock();
+        if(l->sd_pak_get == l->sd_pak_put)
+        {
+            ThreadUnlock();
+            break;
+        }
+        pk = l->sd_paks[l->sd_pak_get & (SD_PAK_QUEUE - 1)];
+        l->sd_pak_get++;
+        ThreadUnlock();
+        PK_free(pk);
+    }
+}
+
+/*
+============
+SD_period
+
+  Switches the serial bit period before the next byte. The peer's
+  receiver learns the new period from the break and sync byte that
+  SD_train puts in front of it; in parallel mode it just follows the
+  strobe.
+============
+*/
+void SD_period(link_t *l, int period)
+{
+    if(period > 0)
+        l->sd_new_period = period;
+}
+
+int SD_pending(link_t *l)
+{
+    return l->sd_new_period;
+}
+
+void SD_buffer_put(byte elem)
+{
+    SD_put(&link_default, elem);
+}
+
+void SD_print_buffer()
+{
+    SD_print(&link_default);
+}
+
 void SD_flush_buffer()
 {
-    buffer_flush(&sender_buffer);
+    SD_flush(&link_default);
 }
 
-void sender_init()
+void SD_set_period(int period)
 {
+    SD_period(&link_default, period);
+}
+
+int SD_period_pending()
+{
+    return SD_pending(&link_default);
+}
+
+static void SD_init(link_t *l)
+{
+    int i;
+
     wiringPiSetup();
-    pinMode(TX, OUTPUT);
+    pinMode(l->tx, OUTPUT);
+
+    if(l->mode == LINK_PARALLEL)
+    {
+        for(i=0; i<l->lanes; i++)
+            pinMode(l->tx_data + i, OUTPUT);
+        pinMode(l->tx_strobe, OUTPUT);
+        l->sd_strobe = LOW;
+        digitalWrite(l->tx_strobe, l->sd_strobe);
+    }
+    else if(l->mode == LINK_SYNC)
+    {
+        pinMode(l->tx_clock, OUTPUT);
+        digitalWrite(l->tx_clock, LOW);
+    }
+
+    if(l->flow == FLOW_RTSCTS)
+        pinMode(l->cts, INPUT);
 
 #ifdef _DEBUG
     printf("Sender::GPIO TX is ready\n");
 #endif /*// _DEBUG*/
 
-    buffer_init(&sender_buffer, BUFFER_SIZE);
-    digitalWrite(TX, HIGH);
+    buffer_init(&l->sd_buffer, BUFFER_SIZE);
+    digitalWrite(l->tx, HIGH);
     delay(BAUD_RATE);
     delay(BAUD_RATE); /* sleep for 2 bit */
-    flag_sender_ready = 1;
+    l->sd_ready = 1;
 
 #ifdef _DEBUG
     printf("Sender::sender is ready\n");
@@ -79,139 +189,269 @@ void sender_init()
 
 }
 
-void sender_main()
+/*
+============
+SD_wait_until
+
+  Bit times are counted from the first edge of a frame rather than
+  from the last delay, so the time spent writing the pin doesn't add up
+  over the frame
+============
+*/
+static void SD_wait_until(unsigned int *due, int ms)
 {
+    unsigned int now;
 
-    sender_init();
+    *due += ms;
+    now = millis();
+    if((int)(*due - now) > 0)
+        delay(*due - now);
+}
 
-    for(;;)
+/*
+============
+SD_send_serial
+
+  |0|D0|D1|D2|D3|D4|D5|D6|D7|1|1| on TX, one bit per tx_period,
+  D7 first if msb is set, then gap idle bit periods
+============
+*/
+static void SD_send_serial(link_t *l, byte elem)
+{
+    unsigned int due = millis();
+    int i;
+
+    digitalWrite(l->tx, LOW);  /* start bit */
+    SD_wait_until(&due, l->tx_period);
+
+    for(i=0; i<8; i++)
     {
-        if(!buffer_empty(&sender_buffer))
-        {
+        if(l->msb ? (elem >> (7 - i)) & 1 : (elem >> i) & 1)
+            digitalWrite(l->tx, HIGH);
+        else
+            digitalWrite(l->tx, LOW);
+        SD_wait_until(&due, l->tx_period);
+    }
 
-#ifdef _DEBUG
-            printf("Sender::sending...\n");
-#endif /*// _DEBUG*/
+    digitalWrite(l->tx, HIGH); /*stop bit*/
+    SD_wait_until(&due, l->tx_period);
 
-            digitalWrite(TX, LOW);  /* start bit */
-            delay(BAUD_RATE);
+    delay(l->tx_period);   /* optional */
 
-            buffer_get(&sender_buffer, &elem);
+    if(l->gap)
+        delay(l->tx_period * l->gap);
 
-#ifdef _MSB
-            if((elem >> 7) & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
+    delay(l->tx_period);
+}
 
-            if((elem >> 6) & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
+/*
+============
+SD_send_manchester
 
-            if((elem >> 5) & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
+  start bit 0 and 8 data bits, each sent as two half bits:
+  0 = HIGH then LOW, 1 = LOW then HIGH. The line idles HIGH, so the
+  first edge the receiver sees is the middle of the start bit.
+============
+*/
+static void SD_send_manchester(link_t *l, byte elem)
+{
+    int i;
+    int bit;
 
-            if((elem >> 4) & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
+    for(i=-1; i<8; i++)
+    {
+        if(i < 0)
+            bit = 0;
+        else
+            bit = l->msb ? (elem >> (7 - i)) & 1 : (elem >> i) & 1;
+        digitalWrite(l->tx, !bit);
+        delay(l->tx_period / 2);
+        digitalWrite(l->tx, bit);
+        delay(l->tx_period / 2);
+    }
 
-            if((elem >> 3) & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
+    digitalWrite(l->tx, HIGH);     /* idle */
+    delay(l->tx_period);
+    delay(l->tx_period);
 
-            if((elem >> 2) & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
+    if(l->gap)
+        delay(l->tx_period * l->gap);
+}
 
-            if((elem >> 1) & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
+/*
+============
+SD_send_parallel
+
+  Puts lanes bits on the data pins, then toggles the strobe, one
+  strobe edge per tx_period.
+  With 8 lanes every strobe edge carries a byte; with 4 lanes the low
+  nibble goes with the rising and the high nibble with the falling
+  edge, so the receiver can't lose track of which half it is reading.
+============
+*/
+static void SD_send_parallel(link_t *l, byte elem)
+{
+    unsigned int due;
+    int i;
+    int shift;
 
-            if(elem & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
-#else
-            if(elem & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
+    due = millis();
+    for(shift=0; shift<8; shift+=l->lanes)
+    {
+        for(i=0; i<l->lanes; i++)
+            digitalWrite(l->tx_data + i, (elem >> (shift + i)) & 1);
+        l->sd_strobe = !l->sd_strobe;
+        digitalWrite(l->tx_strobe, l->sd_strobe);
+        SD_wait_until(&due, l->tx_period);
+    }
+}
 
-            if((elem >> 1) & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
+/*
+============
+SD_send_sync
+
+  |0|D0|D1|D2|D3|D4|D5|D6|D7|1| on TX, every bit set up while TX_CLOCK
+  is low and latched by the receiver on the rising edge. No bit timing
+  is shared with the receiver; it only has to poll TX_CLOCK at least
+  twice per clock period.
+============
+*/
+static void SD_clock_bit(link_t *l, int bit)
+{
+    digitalWrite(l->tx, bit);
+    delayMicroseconds(l->clock_half);
+    digitalWrite(l->tx_clock, HIGH);
+    delayMicroseconds(l->clock_half);
+    digitalWrite(l->tx_clock, LOW);
+}
 
-            if((elem >> 2) & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
+static void SD_send_sync(link_t *l, byte elem)
+{
+    int i;
 
-            if((elem >> 3) & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
+    SD_clock_bit(l, LOW);      /* start bit */
+    for(i=0; i<8; i++)
+        SD_clock_bit(l, (elem >> i) & 1);
+    SD_clock_bit(l, HIGH);     /* stop bit */
+}
 
-            if((elem >> 4) & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
+/*
+============
+SD_train
 
-            if((elem >> 5) & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
+  |break|idle|LINK_SYNC_BYTE| the break is long enough at the old and
+  the new period, the sync byte is sent at the new period as NRZ
+  whatever the coding, so RC_train can time its edges.
+============
+*/
+static void SD_train(link_t *l)
+{
+    unsigned int due;
+    int longest;
+    int i;
 
-            if((elem >> 6) & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
+    longest = l->tx_period > l->sd_new_period ? l->tx_period : l->sd_new_period;
 
-            if((elem >> 7) & 1)
-                digitalWrite(TX, HIGH);
-            else
-                digitalWrite(TX, LOW);
-            delay(BAUD_RATE);
-#endif  /* _MSB */
+    digitalWrite(l->tx, LOW);
+    delay(longest * LINK_BREAK_BITS);
+    digitalWrite(l->tx, HIGH);
+    delay(longest * 2);
 
-            digitalWrite(TX, HIGH); /*stop bit*/
-            delay(BAUD_RATE);
+    l->tx_period = l->sd_new_period;
+    l->sd_new_period = 0;
 
-            delay(BAUD_RATE);   /* optional */
+    due = millis();
+    digitalWrite(l->tx, LOW);  /* start bit */
+    SD_wait_until(&due, l->tx_period);
+    for(i = 0; i < 8; i++)
+    {
+        digitalWrite(l->tx, (LINK_SYNC_BYTE >> i) & 1);
+        SD_wait_until(&due, l->tx_period);
+    }
+    digitalWrite(l->tx, HIGH); /* stop bit */
+    delay(l->tx_period * 2);
+}
 
-#ifdef _SLOW
-            delay(BAUD_RATE * 11);
-#endif /*// _SLOW*/
+static void SD_send_byte(link_t *l, byte elem)
+{
+    if(l->flow == FLOW_RTSCTS && !digitalRead(l->cts))
+    {
+#ifdef _DEBUG
+        printf("Sender::peer is busy, holding...\n");
+#endif /*// _DEBUG*/
+        for(; !digitalRead(l->cts);)
+            delay(_SCAN_TIME_SPAN);
+    }
 
-#ifdef _SLOWX2
-            delay(BAUD_RATE * 22);
-#endif /*// _SLOWX2*/
+    if(l->mode == LINK_PARALLEL)
+        SD_send_parallel(l, elem);
+    else if(l->mode == LINK_SYNC)
+        SD_send_sync(l, elem);
+    else if(l->coding == CODING_MANCHESTER)
+        SD_send_manchester(l, elem);
+    else
+        SD_send_serial(l, elem);
+}
 
+void SD_main(link_t *l)
+{
+    pk_buf_t *pk;
+    byte elem;
+    int i;
+
+    SD_init(l);
+
+    for(;;)
+    {
+        if(l->sd_new_period && l->mode == LINK_SERIAL)
+            SD_train(l);
+        else if(l->sd_new_period)
+        {
+            if(l->mode == LINK_PARALLEL)    /* the strobe clocks the peer */
+                l->tx_period = l->sd_new_period;
+            l->sd_new_period = 0;
         }
 
-        delay(BAUD_RATE);
+        pk = NULL;
+        ThreadLock();
+        if(l->sd_pak_get != l->sd_pak_put)
+            pk = l->sd_paks[l->sd_pak_get++ & (SD_PAK_QUEUE - 1)];
+        ThreadUnlock();
+
+        if(pk)
+        {
+
+#ifdef _DEBUG
+            printf("Sender::sending packet...\n");
+#endif /*// _DEBUG*/
+
+            LT_mark(pk, LT_SD_QUEUE);
+            PR_PROBE2(tx_start, l->id, PK_length(pk));
+            for(i=0; i<PK_length(pk); i++)
+                SD_send_byte(l, PK_data(pk)[i]);
+            PR_PROBE2(tx_end, l->id, PK_length(pk));
+            LT_mark(pk, LT_WIRE);
+            PK_free(pk);
+
+        }
+        else if(!buffer_empty(&l->sd_buffer))
+        {
+
+#ifdef _DEBUG
+            printf("Sender::sending...\n");
+#endif /*// _DEBUG*/
+
+            buffer_get(&l->sd_buffer, &elem);
+            SD_send_byte(l, elem);
+
+        }
+        else
+            delay(BAUD_RATE);
     }
 
 }
+
+void sender_main()
+{
+    SD_main(&link_default);
+}
@@ -16,58 +16,300 @@
 #endif
 
 #include "shared.h"
+#include "threads.h"
+#include "probes.h"
 #include "client.h"
 
 #include "server.h"
 
 
-int flag_server_ready;
-int flag_server_isdumping;
-static int server_resend_count;
+/* lanes are served in strict priority order, lowest index first */
+static char *server_lane_names[SV_LANES] = {"control", "data"};
 
-static char server_msg_buffer[MAX_MSG_LENGTH + 1];
 
+static void SV_set_state ( link_t *l, int ticket, int state )
+{
+    if(l->sv_ticket_id[ticket & (SV_TICKET_HISTORY - 1)] != ticket)
+        l->sv_ticket_resends[ticket & (SV_TICKET_HISTORY - 1)] = 0;
+    l->sv_ticket_id[ticket & (SV_TICKET_HISTORY - 1)] = ticket;
+    l->sv_ticket_state[ticket & (SV_TICKET_HISTORY - 1)] = state;
+}
+
+/*
+============
+SV_post_pak
+
+  Queues a packet buffer on a lane without blocking or copying, the
+  queue takes a reference of its own. pk must still have PK_HEADROOM
+  in front. Returns a ticket (> 0) that can be polled with SV_state,
+  -1 if the lane is full, -2 if the message is empty or too long.
+============
+*/
+int SV_post_pak ( link_t *l, pk_buf_t *pk, int lane )
+{
+    sv_lane_t *q;
+    sv_msg_t *slot;
+    int ticket;
+
+    if(PK_length(pk) <= 0 || PK_length(pk) > MAX_MSG_LENGTH || pk->head < PK_HEADROOM || lane < 0 || lane >= SV_LANES)
+        return -2;
+
+    q = &l->sv_lanes[lane];
+
+    PK_ref(pk);
+    LT_start(pk);
+    ThreadLock();
+    if(q->put_index - q->get_index == q->size)
+    {
+        ThreadUnlock();
+        PK_free(pk);
+        return -1;
+    }
+    slot = &q->msgs[q->put_index & (q->size - 1)];
+    ticket = l->sv_next_ticket++;
+    if(l->sv_next_ticket <= 0)
+        l->sv_next_ticket = 1;
+    slot->ticket = ticket;
+    slot->pk = pk;
+    SV_set_state(l, ticket, SV_MSG_PENDING);
+    q->put_index++;
+    PR_PROBE3(pak_enqueue, l->id, ticket, PK_length(pk));  /* before SV_frame can add the header */
+    ThreadUnlock();
+
+    return ticket;
+}
+
+/*
+============
+SV_post
+
+  SV_post_pak for a message in a plain buffer, which is copied into a
+  packet buffer. -1 also means the packet pool is exhausted.
+============
+*/
+int SV_post ( link_t *l, unsigned char *msg, int length, int lane )
+{
+    pk_buf_t *pk;
+    int ticket;
+
+    if(length <= 0 || length > MAX_MSG_LENGTH || lane < 0 || lane >= SV_LANES)
+        return -2;
+
+    pk = PK_alloc();
+    if(!pk)
+        return -1;
+    memcpy(PK_put(pk, length), msg, length);
+    ticket = SV_post_pak(l, pk, lane);
+    PK_free(pk);
+
+    return ticket;
+}
+
+/*
+============
+SV_drop
+
+  Discards everything still queued on a lane, e.g. strokes made
+  obsolete by a clear. Packets of the lane still waiting for their
+  ACK were handed to the sender already, ahead of anything posted
+  from now on, but they are not resent: a resend would arrive after
+  the clear and bring the old strokes back.
+============
+*/
+void SV_drop ( link_t *l, int lane )
+{
+    sv_lane_t *q;
+    sv_msg_t *slot;
+    pk_buf_t *pk;
+    int i;
+
+    if(lane < 0 || lane >= SV_LANES)
+        return;
+
+    q = &l->sv_lanes[lane];
+
+    ThreadLock();
+    for(i=0; i<SV_WINDOW; i++)
+        if(l->sv_flight[i].state != SV_FLIGHT_FREE && l->sv_flight[i].lane == lane)
+            l->sv_flight[i].dropped = 1;
+    ThreadUnlock();
+
+    for(;;)
+    {
+        ThreadLock();
+        if(q->get_index == q->put_index)
+        {
+            ThreadUnlock();
+            break;
+        }
+        slot = &q->msgs[q->get_index & (q->size - 1)];
+        pk = slot->pk;
+        slot->pk = NULL;
+        SV_set_state(l, slot->ticket, SV_MSG_DROPPED);
+        q->get_index++;
+        ThreadUnlock();
+        PK_free(pk);
+    }
+}
+
+int SV_state ( link_t *l, int ticket )
+{
+    if(ticket <= 0 || l->sv_ticket_id[ticket & (SV_TICKET_HISTORY - 1)] != ticket)
+        return SV_MSG_EXPIRED;
+    return l->sv_ticket_state[ticket & (SV_TICKET_HISTORY - 1)];
+}
+
+/* times the packet of ticket was resent, -1 once it expired */
+int SV_resends ( link_t *l, int ticket )
+{
+    if(ticket <= 0 || l->sv_ticket_id[ticket & (SV_TICKET_HISTORY - 1)] != ticket)
+        return -1;
+    return l->sv_ticket_resends[ticket & (SV_TICKET_HISTORY - 1)];
+}
+
+int SV_length ( link_t *l, int lane )
+{
+    return l->sv_lanes[lane].put_index - l->sv_lanes[lane].get_index;
+}
+
+int SV_pending ( link_t *l )
+{
+    int lane;
+    int length = 0;
+
+    for(lane=0; lane<SV_LANES; lane++)
+        length += SV_length(l, lane);
+    return length;
+}
+
+static int SV_in_flight ( link_t *l )
+{
+    int i;
+    int n = 0;
+
+    for(i=0; i<SV_WINDOW; i++)
+        if(l->sv_flight[i].state != SV_FLIGHT_FREE)
+            n++;
+    return n;
+}
+
+void SV_print ( link_t *l )
+{
+    int lane;
+
+    printf("------------------\n");
+    for(lane=0; lane<SV_LANES; lane++)
+        printf("%-8s queued = %d, size = %d\n", server_lane_names[lane],
+               SV_length(l, lane), l->sv_lanes[lane].size);
+    printf("in flight = %d, window = %d\n", SV_in_flight(l), l->sv_window);
+    if(l->compress)
+        printf("compressed = %d packets, %d bytes saved\n", l->sv_stats_compressed, l->sv_stats_saved);
+    printf("next ticket = %d, server %s\n", l->sv_next_ticket,
+           l->sv_ready ? "ready" : "busy");
+    printf("------------------\n");
+}
+
+/*
+============
+SV_stats
+
+  Running totals since startup, a caller takes the difference of two
+  readings to get the error rate over an interval
+============
+*/
+void SV_stats ( link_t *l, int *sent, int *resent, int *failed )
+{
+    *sent = l->sv_stats_sent;
+    *resent = l->sv_stats_resent;
+    *failed = l->sv_stats_failed;
+}
+
+int SV_post_msg_lane ( unsigned char *msg, int length, int lane )
+{
+    return SV_post(&link_default, msg, length, lane);
+}
+
+int SV_post_pak_lane ( pk_buf_t *pk, int lane )
+{
+    return SV_post_pak(&link_default, pk, lane);
+}
+
+int SV_post_msg ( unsigned char *msg, int length )
+{
+    return SV_post(&link_default, msg, length, SV_LANE_DATA);
+}
+
+void SV_drop_lane ( int lane )
+{
+    SV_drop(&link_default, lane);
+}
+
+int SV_msg_state ( int ticket )
+{
+    return SV_state(&link_default, ticket);
+}
+
+int SV_msg_resends ( int ticket )
+{
+    return SV_resends(&link_default, ticket);
+}
+
+int SV_lane_length ( int lane )
+{
+    return SV_length(&link_default, lane);
+}
+
+int SV_queue_length ( void )
+{
+    return SV_pending(&link_default);
+}
+
+void SV_print_queue ( void )
+{
+    SV_print(&link_default);
+}
+
+void SV_get_stats ( int *sent, int *resent, int *failed )
+{
+    SV_stats(&link_default, sent, resent, failed);
+}
 
 #ifdef _DEBUG
 void SV_insert_msg ( unsigned char *msg )   /*function may block process */
 {
-    if(strlen(msg) > MAX_MSG_LENGTH)
+    if(strlen((char *)msg) > MAX_MSG_LENGTH)
     {
         printf("Server::max message length exceeded, aborted!\n");
         return;
     }
-    if(flag_server_ready)
-        strcpy(server_msg_buffer, msg);
-    else
+    if(SV_post_msg(msg, strlen((char *)msg)) == -1)
     {
         printf("Server::server is busy, please wait...\n");
-        for(; !flag_server_ready;)
+        for(; SV_post_msg(msg, strlen((char *)msg)) == -1;)
             delay(BAUD_RATE);
-        strcpy(server_msg_buffer, msg);
     }
 }
 #else
 void SV_insert_msg ( unsigned char *msg )
 {
-    if(strlen(msg) > MAX_MSG_LENGTH)
+    if(strlen((char *)msg) > MAX_MSG_LENGTH)
         return;
-    for(; !flag_server_ready;)
+    for(; SV_post_msg(msg, strlen((char *)msg)) == -1;)
         delay(BAUD_RATE);
-    strcpy(server_msg_buffer, msg);
 }
 #endif /*// _DEBUG*/
 
 #ifdef _DEBUG
 int SV_insert_msg_nb ( unsigned char *msg )
 {
-    if(strlen(msg) > MAX_MSG_LENGTH)
+    if(strlen((char *)msg) > MAX_MSG_LENGTH)
     {
         printf("Server::max message length exceeded, aborted!\n");
         return -2;
     }
-    if(flag_server_ready)
+    if(flag_server_ready && !SV_queue_length())
     {
-        strcpy(server_msg_buffer, msg);
+        SV_post_msg(msg, strlen((char *)msg));
         return 0;
     }
     else
@@ -79,11 +321,11 @@ int SV_insert_msg_nb ( unsigned char *msg )
 #else
 int SV_insert_msg_nb ( unsigned char *msg )
 {
-    if(strlen(msg) > MAX_MSG_LENGTH)
+    if(strlen((char *)msg) > MAX_MSG_LENGTH)
         return -2;
-    if(flag_server_ready)
+    if(flag_server_ready && !SV_queue_length())
     {
-        strcpy(server_msg_buffer, msg);
+        SV_post_msg(msg, strlen((char *)msg));
         return 0;
     }
     else
@@ -91,27 +333,236 @@ int SV_insert_msg_nb ( unsigned char *msg )
 }
 #endif /*// _DEBUG*/
 
-void server_main ( void )
+/*
+============
+SV_ack
+
+  Called by the client for every ACK packet. Marks the oldest packet
+  in flight with that CRC16, in either byte order, as acknowledged.
+  A stray ACK is ignored and the packet resent when its timer runs out.
+============
+*/
+void SV_ack ( link_t *l, byte crc0, byte crc1 )
 {
+    sv_flight_t *f;
+    sv_flight_t *found = NULL;
+    int i;
 
-    byte server_pak[BUFFER_SIZE + 1];
+    ThreadLock();
+    for(i=0; i<SV_WINDOW; i++)
+    {
+        f = &l->sv_flight[i];
+        if(f->state != SV_FLIGHT_WAIT)
+            continue;
+        if(!((f->crc[0] == crc0 && f->crc[1] == crc1) || (f->crc[0] == crc1 && f->crc[1] == crc0)))
+            continue;
+        if(!found || f->ticket - found->ticket < 0)
+            found = f;
+    }
+    if(found)
+        found->state = SV_FLIGHT_ACKED;
+    ThreadUnlock();
 
-    byte *pak_data_length = &server_pak[1];
-    byte *pak_data = &server_pak[2];
-    unsigned short *pak_crc;
-    byte *pak_crc_byte;
-    byte *pak_end;
+    if(found)
+    {
+        TM_cancel(&found->timer);
+        LT_since(LT_ACK, found->sent);
+        PR_PROBE3(ack, l->id, found->ticket, micros() - found->sent);
+    }
+#ifdef _DEBUG
+    else
+        printf("Server::ACK packet CRC16 matches no packet\n");
+#endif /*// _DEBUG*/
+}
+
+/* runs on the timer thread, hands the resend to SV_main */
+static void SV_timeout ( void *arg )
+{
+    sv_flight_t *f = (sv_flight_t *)arg;
+
+    ThreadLock();
+    if(f->state == SV_FLIGHT_WAIT)
+        f->state = SV_FLIGHT_TIMEOUT;
+    ThreadUnlock();
+}
+
+/*
+============
+SV_transmit
 
+  Hands a packet to the sender and starts its retransmit timer. The
+  timeout allows for the packets queued in front of it on the wire.
+============
+*/
+static void SV_transmit ( link_t *l, sv_flight_t *f )
+{
+    ThreadLock();
+    f->state = SV_FLIGHT_WAIT;
+    ThreadUnlock();
+    TM_add(&f->timer, l->ack_wait * l->tx_period * SV_in_flight(l));
+    f->sent = micros();
+    f->pk->stamp = f->sent | 1;
+    SD_send(l, f->pk);
+}
+
+static void SV_release ( link_t *l, sv_flight_t *f, int state )
+{
+    pk_buf_t *pk = f->pk;
+
+    TM_cancel(&f->timer);
+    ThreadLock();
+    SV_set_state(l, f->ticket, state);
+    f->pk = NULL;
+    f->state = SV_FLIGHT_FREE;
+    ThreadUnlock();
+    PK_free(pk);
+}
+
+/*
+============
+SV_compress
+
+  Replaces *pk by a buffer of the server's own holding the payload LZ
+  compressed, if that is shorter; the other holders of the original
+  never see its data change. Returns 1 if it did.
+============
+*/
+static int SV_compress ( link_t *l, pk_buf_t **pk )
+{
+    pk_buf_t *lz;
+    int length;
+
+    lz = PK_alloc();
+    if(!lz)
+        return 0;
+    length = LZ_compress(PK_data(*pk), PK_length(*pk), PK_put(lz, PK_length(*pk) - 1), PK_length(*pk) - 1);
+    if(length <= 0)
+    {
+        PK_free(lz);
+        return 0;
+    }
+    PK_trim(lz, length);
+    lz->stamp = (*pk)->stamp;
+
+    l->sv_stats_compressed++;
+    l->sv_stats_saved += PK_length(*pk) - length;
+    PK_free(*pk);
+    *pk = lz;
+    return 1;
+}
+
+/*
+============
+SV_frame
+
+  Takes the next message of the highest priority lane into a free
+  window slot and puts header and CRC16 around it, in place.
+  Returns 0 if there was none.
+
+  The client has no sequence check, so a control message holds back
+  everything after it until it is ACKed or given up: an UNDO resent
+  after its REDO, or after a CLEAR, would otherwise land on the wrong
+  line. Resends of one op only repeat it, the ops are idempotent.
+============
+*/
+static int SV_frame ( link_t *l, sv_flight_t *f )
+{
+    sv_lane_t *q;
+    sv_msg_t *slot;
+    pk_buf_t *pk;
+    byte *pak_header;
+    byte *pak_data;
+    byte *pak_crc_byte;
+    int pak_data_length;
+    int compressed;
+    int lane;
     int i;
     unsigned short crcvalue;
 
-    server_pak[0] = 0;  /* start bit */
+    pk = NULL;
+    ThreadLock();
+    for(i=0; i<SV_WINDOW; i++)
+        if(l->sv_flight[i].state != SV_FLIGHT_FREE && l->sv_flight[i].lane == SV_LANE_CONTROL)
+            break;
+    for(lane=0; lane<SV_LANES && i == SV_WINDOW; lane++)
+    {
+        q = &l->sv_lanes[lane];
+        if(q->get_index == q->put_index)
+            continue;
+        slot = &q->msgs[q->get_index & (q->size - 1)];
+        f->ticket = slot->ticket;
+        f->lane = lane;
+        f->dropped = 0;
+        pk = slot->pk;
+        slot->pk = NULL;
+        q->get_index++;
+        SV_set_state(l, f->ticket, SV_MSG_SENDING);
+        break;
+    }
+    ThreadUnlock();
 
+    if(!pk)
+        return 0;
+
+    LT_mark(pk, LT_SV_QUEUE);
+
+    compressed = l->compress && SV_compress(l, &pk);
+
+    pak_data_length = PK_length(pk);
+    pak_data = PK_data(pk);
+    CRC_Init(&crcvalue);
+    if(compressed)  /* so a type byte flipped to 0 fails the check */
+        CRC_ProcessByte(&crcvalue, 1);
+    for(i=0; i<pak_data_length; i++) /* crc16 CCITT_FALSE */
+        CRC_ProcessByte(&crcvalue, pak_data[i]);
+    crcvalue = CRC_Value(crcvalue);
+    pak_crc_byte = PK_put(pk, 2);
+    memcpy(pak_crc_byte, &crcvalue, 2);
+
+    pak_header = PK_push(pk, 2);
+    pak_header[0] = compressed ? 1 : 0;  /* start bit, then 0 if plain or 1 if LZ compressed */
+    pak_header[1] = pak_data_length;
+
+    f->pk = pk;
+    f->crc[0] = pak_crc_byte[0];
+    f->crc[1] = pak_crc_byte[1];
+    f->resends = 0;
+
+#ifdef _DEBUG
+    printf("Server::ready to send packet:");
+    for(i=0; i<PK_length(pk); i++)
+    {
+        printf("%d ", PK_data(pk)[i]);
+    }
+    printf("\n");
+#endif /*// _DEBUG*/
+
+    return 1;
+}
+
+/*
+============
+SV_main
+
+  Keeps up to sv_window packets waiting for their ACK. Timeouts come
+  from the timer thread (TM_main), ACKs from the client (SV_ack); the
+  server only reacts to them, so it never blocks on one packet.
+============
+*/
+void SV_main ( link_t *l )
+{
+    sv_flight_t *f;
+    int state;
+    int dropped;
+    int i;
+
+    for(i=0; i<SV_WINDOW; i++)
+        TM_init(&l->sv_flight[i].timer, SV_timeout, &l->sv_flight[i]);
 
-    for(; !flag_sender_ready || !flag_receiver_ready;)
+    for(; !l->sd_ready || !l->rc_ready;)
         delay(BAUD_RATE);
-    SD_flush_buffer();
-    flag_server_ready = 1;
+    SD_flush(l);
+    l->sv_ready = 1;
 
 #ifdef _DEBUG
             printf("Server::server is ready\n");
@@ -119,109 +570,73 @@ void server_main ( void )
 
     for(;;)
     {
-        if(server_msg_buffer[0]!='\0')
+        for(i=0; i<SV_WINDOW; i++)
         {
-            flag_server_ready = 0;
-
-            for(i=0; server_msg_buffer[i]!='\0' && i<MAX_MSG_LENGTH + 1; i++)
-                pak_data[i] = server_msg_buffer[i];
+            f = &l->sv_flight[i];
 
-            server_msg_buffer[0]='\0';
-            *pak_data_length = i;
-            pak_crc = (unsigned short *) &pak_data[i];
-            pak_crc_byte = &pak_data[i];
-            pak_end = &pak_data[i+2];
-            pak_end[0] = '\0';
+            ThreadLock();
+            state = f->state;
+            dropped = f->dropped;
+            ThreadUnlock();
 
-            CRC_Init(&crcvalue);
-            for(i=0; i<*pak_data_length; i++) /* crc16 CCITT_FALSE */
-                CRC_ProcessByte(&crcvalue, pak_data[i]);
-            *pak_crc = CRC_Value(crcvalue);
-
-#ifdef _DEBUG
-            printf("Server::ready to send packet:");
-            for(i=0; i<*pak_data_length + 4; i++)
+            if(state == SV_FLIGHT_ACKED)
             {
-                printf("%d ", server_pak[i]);
+                printf("Server::ACK packet received\nServer::message sent successfully\n");
+                l->sv_stats_sent++;
+                SV_release(l, f, SV_MSG_SENT);
             }
-            printf("\n");
-#endif /*// _DEBUG*/
-
-            for(; flag_client_isdumping;)
-                delay(BAUD_RATE);
+            else if(state == SV_FLIGHT_TIMEOUT)
+            {
+                if(dropped)
+                    SV_release(l, f, SV_MSG_DROPPED);
+                else if(f->resends == 2)
+                {
+                    printf("Server::second resend failed, aborted!\n");
+                    l->sv_stats_failed++;
+                    SV_release(l, f, SV_MSG_FAILED);
+                }
+                else
+                {
+                    printf("Server::ACK timeout, resending...\n");
+                    f->resends++;
+                    l->sv_stats_resent++;
+                    l->sv_ticket_resends[f->ticket & (SV_TICKET_HISTORY - 1)]++;
+                    PR_PROBE3(resend, l->id, f->ticket, f->resends);
+                    SV_transmit(l, f);
+                }
+            }
+        }
 
-            flag_server_isdumping = 1;
-            for(i=0; i<*pak_data_length + 4; i++)
-                SD_buffer_put(server_pak[i]);
-            flag_server_isdumping = 0;
+        for(i=0; i<l->sv_window && i<SV_WINDOW; i++)
+        {
+            f = &l->sv_flight[i];
+            if(f->state == SV_FLIGHT_FREE && SV_frame(l, f))
+            {
+                l->sv_ready = 0;
+                SV_transmit(l, f);
 
 #ifdef _DEBUG
-            printf("Server::sending packet...\n");
+                printf("Server::sending packet...\n");
 #endif /*// _DEBUG*/
 
-            for(; !flag_server_ready;)
-            {
-                for(i=0; i<MAX_WAIT_TIMES; i++,delay(BAUD_RATE))  /* fix me */
-                    if(flag_client_get_ack)
-                    {
-                        if((client_crc16[0] == pak_crc_byte[0] && client_crc16[1] == pak_crc_byte[1]) || (client_crc16[0] == pak_crc_byte[1] && client_crc16[1] == pak_crc_byte[0]))
-                        {
-                            printf("Server::ACK packet received\nServer::message sent successfully\n");
-                            server_resend_count = 0;
-                            flag_server_ready = 1;
-                            break;
-                        }
-                        else
-                        {
-                            printf("Server::ACK packet CRC16 failed, resending...\n");
-                            if(server_resend_count == 2)
-                            {
-                                printf("Server::second resend failed, aborted!\n");
-                                flag_server_ready = 1;
-                                server_resend_count = 0;
-                                break;
-                            }
-                            server_resend_count++;
-                            for(; flag_client_isdumping;)
-                                delay(BAUD_RATE);
-
-                            flag_server_isdumping = 1;
-                            for(i=0; i<*pak_data_length + 4; i++)
-                                SD_buffer_put(server_pak[i]);
-                            flag_server_isdumping = 0;
-
-                            break;
-                        }
-                    }
-
-                if(!flag_client_get_ack)
-                {
-                        printf("Server::ACK timeout, resending...\n");
-                        if(server_resend_count == 2)
-                        {
-                            printf("Server::second resend failed, aborted!\n");
-                            flag_server_ready = 1;
-                            server_resend_count = 0;
-                            break;
-                        }
-                        server_resend_count++;
-                        for(; flag_client_isdumping;)
-                            delay(BAUD_RATE);
-
-                        flag_server_isdumping = 1;
-                        for(i=0; i<*pak_data_length + 4; i++)
-                            SD_buffer_put(server_pak[i]);
-                        flag_server_isdumping = 0;
-                }
-
-                flag_client_get_ack = 0;
             }
+        }
+
+        if(!SV_in_flight(l) && !l->sv_ready)
+        {
+            l->sv_ready = 1;
 
 #ifdef _DEBUG
             printf("Server::server is ready\n");
 #endif /*// _DEBUG*/
 
         }
-        delay(BAUD_RATE);
+
+        delay(_SCAN_TIME_SPAN);
     }
 }
+
+void server_main ( void )
+{
+    SV_main(&link_default);
+}
@@ -13,6 +13,9 @@ frame structure
 |0|D0|D1|D2|D3|D4|D5|D6|D7|1|1|
 data packet structure
 |0|length of data|-data-|-|crc16byte0|crc16byte1|
+LZ compressed data packet structure, see compress.h
+|1|length of data|-LZ data-|-|crc16byte0|crc16byte1|
+  the crc16 covers the type byte 1 and the LZ data
 ACK (acknowledge) packet structure
 |6|crc16byte0|crc16byte1|
 
@@ -33,12 +36,47 @@ extern "C"
 {
 #endif
 
-extern int flag_server_ready;
-extern int flag_server_isdumping;
-
+/* queue sizes are in link.h */
+
+/* message classes, served in strict priority order */
+#define	SV_LANE_CONTROL     0   /* clear, undo, resync... */
+#define	SV_LANE_DATA        1   /* strokes and text */
+
+/* ticket states returned by SV_msg_state */
+#define	SV_MSG_EXPIRED      -1
+#define	SV_MSG_PENDING      0
+#define	SV_MSG_SENDING      1
+#define	SV_MSG_SENT         2
+#define	SV_MSG_FAILED       3
+#define	SV_MSG_DROPPED      4
+
+int SV_post(link_t *l, unsigned char *msg, int length, int lane);
+int SV_post_pak(link_t *l, pk_buf_t *pk, int lane);
+void SV_drop(link_t *l, int lane);
+int SV_state(link_t *l, int ticket);
+int SV_resends(link_t *l, int ticket);
+int SV_length(link_t *l, int lane);
+int SV_pending(link_t *l);
+void SV_print(link_t *l);
+void SV_stats(link_t *l, int *sent, int *resent, int *failed);
+void SV_ack(link_t *l, byte crc0, byte crc1);
+void SV_main(link_t *l);
+
+/* the same on link_default */
 void SV_insert_msg(unsigned char *msg);
 int SV_insert_msg_nb(unsigned char *msg);
 
+int SV_post_msg(unsigned char *msg, int length);
+int SV_post_msg_lane(unsigned char *msg, int length, int lane);
+int SV_post_pak_lane(pk_buf_t *pk, int lane);
+void SV_drop_lane(int lane);
+int SV_msg_state(int ticket);
+int SV_msg_resends(int ticket);
+int SV_lane_length(int lane);
+int SV_queue_length();
+void SV_print_queue();
+void SV_get_stats(int *sent, int *resent, int *failed);
+
 void server_main();
 
 #ifdef __cplusplus
@@ -38,38 +38,117 @@ extern "C"
 
 #define	MAX_MSG_LENGTH  (BUFFER_SIZE - 4)  /* BUFFER_SIZE - 4 */
 
+/* defaults of the link settings ack_wait and gap, see profile.h */
 #ifdef _SLOW
 #define	MAX_WAIT_TIMES  (BUFFER_SIZE + 6) * 22
+#define	LINK_GAP        11
 #elif defined _SLOWX2
 #define	MAX_WAIT_TIMES  (BUFFER_SIZE + 6) * 33
+#define	LINK_GAP        22
 #else
 #define	MAX_WAIT_TIMES  (BUFFER_SIZE + 6) * 11
+#define	LINK_GAP        0
 #endif
 
+#define	LINK_SERIAL     0   /* one bit per BAUD_RATE on TX/RX */
+#define	LINK_PARALLEL   1   /* link_lanes bits per BAUD_RATE on the data pins */
+#define	LINK_SYNC       2   /* one bit per TX_CLOCK pulse on TX/RX */
+
+#define	CODING_NRZ          0   /* plain levels, receiver samples mid-bit by timing alone */
+#define	CODING_MANCHESTER   1   /* IEEE 802.3, every bit has a mid-bit edge to lock on */
+
+#define	MAX_LANES       8
+
+#define	FLOW_NONE       0
+#define	FLOW_RTSCTS     1
+
+#define	RC_BUFFER_SIZE  256 /* default receive buffer, size must be 2 ^ n */
+#define	RC_FLOW_MARGIN  4   /* drop RTS with this many bytes of room left */
+
+#define	LINK_BREAK_BITS 13      /* LOW for this many bits resets the receiver's bit period */
+#define	LINK_SYNC_BYTE  0x55    /* sent LSB first: |0|1|0|1|0|1|0|1|0|1| */
+
+/* pins of link 0, link n uses the same ones plus n * LINK_PINS */
 #ifdef _SERVER
 #define	TX              0
 #define	RX              1
+#define	TX_STROBE       2
+#define	RX_STROBE       3
+#define	TX_DATA         4   /* TX_DATA .. TX_DATA + MAX_LANES - 1 */
+#define	RX_DATA         12  /* RX_DATA .. RX_DATA + MAX_LANES - 1 */
+#define	TX_CLOCK        20
+#define	RX_CLOCK        21
+#define	RTS             22  /* HIGH while our receiver has room */
+#define	CTS             23  /* the peer's RTS */
 #else
 #define	TX              1
 #define	RX              0
+#define	TX_STROBE       3
+#define	RX_STROBE       2
+#define	TX_DATA         12
+#define	RX_DATA         4
+#define	TX_CLOCK        21
+#define	RX_CLOCK        20
+#define	RTS             23
+#define	CTS             22
 #endif /*// _SERVER*/
 
-extern int flag_sender_ready;
+#ifndef __TIMER__
+#include "timer.h"
+#endif  /*__TIMER__*/
+
+#ifndef __PACKET__
+#include "packet.h"
+#endif  /*__PACKET__*/
 
-extern ring_buffer sender_buffer;
+#ifndef __COMPRESS__
+#include "compress.h"
+#endif  /*__COMPRESS__*/
 
+#ifndef __LATENCY__
+#include "latency.h"
+#endif  /*__LATENCY__*/
+
+#ifndef __LINK__
+#include "link.h"
+#endif  /*__LINK__*/
+
+#ifndef __SCHEDULER__
+#include "scheduler.h"
+#endif  /*__SCHEDULER__*/
+
+/* waits go through the scheduler so the link code also runs as tasks, see LK_run_tasks */
+#ifndef __cplusplus
+#define	delay(ms)               SC_delay(ms)
+#define	delayMicroseconds(us)   SC_delay_us(us)
+#endif
+
+void SD_put(link_t *l, byte elem);
+void SD_send(link_t *l, pk_buf_t *pk);
+int SD_queued(link_t *l);
+void SD_print(link_t *l);
+void SD_flush(link_t *l);
+void SD_period(link_t *l, int period);
+int SD_pending(link_t *l);
+void SD_main(link_t *l);
+
+/* the same on link_default */
 void SD_buffer_put(byte elem);
 void SD_print_buffer();
 void SD_flush_buffer();
+void SD_set_period(int period);
+int SD_period_pending();
 
 void sender_main();
 
 /******************************/
 
-extern int flag_receiver_ready;
-
-extern ring_buffer receiver_buffer;
+byte RC_get(link_t *l);
+void RC_print(link_t *l);
+void RC_flush(link_t *l);
+void RC_main(link_t *l);
 
+/* the same on link_default */
 byte RC_buffer_get();
 void RC_print_buffer();
 void RC_flush_buffer();
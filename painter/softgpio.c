@@ -6,13 +6,24 @@
 
 #ifdef _SOFTGPIO
 
+#ifndef WIN32
+#define _XOPEN_SOURCE 600   /* usleep, clock_gettime */
+#endif
+
 #ifdef WIN32
 #include <windows.h>
 #else
 #include <unistd.h>
+#include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
 #endif
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "cmdlib.h"
+#include "threads.h"
 
 #include "softgpio.h"
 
@@ -23,16 +34,57 @@ typedef struct
 } softgpio_t;
 
 
-/*static char filepath[14][128];*/
-static char filepath[14][9];
-static qboolean pinmode[14] = {true};
+/*
+   Pin tracer. Every thread that touches a pin while tracing is on gets
+   a buffer of its own, claimed once under ThreadLock. After that only
+   the owner writes into it, and it publishes an event by bumping count
+   after filling it in, so recording takes no lock at all. A full buffer
+   drops events and counts them. pinTraceStop merges the buffers by time
+   into a Value Change Dump.
+*/
+
+typedef struct
+{
+    unsigned int sec;       /* since pinTraceStart */
+    unsigned int nsec;
+    short pin;
+    char value;
+    char read;
+} trace_event_t;
+
+typedef struct
+{
+#ifdef WIN32
+    DWORD owner;
+#else
+    pthread_t owner;
+#endif
+    trace_event_t *events;
+    volatile int count;
+    int dropped;
+} trace_buffer_t;
+
+static trace_buffer_t trace_buffers[SOFTGPIO_TRACE_THREADS];
+static volatile int trace_numbuffers;
+static volatile int trace_on;
+static int trace_overflow;      /* threads that found no free buffer */
+static char trace_file[1024];
+static unsigned int trace_start_sec;
+static unsigned int trace_start_nsec;
+
+static void pinTraceRecord(int pin, int value, int read);
+
+
+/*static char filepath[SOFTGPIO_PINS][128];*/
+static char filepath[SOFTGPIO_PINS][12];
+static qboolean pinmode[SOFTGPIO_PINS] = {true};
 
 int wiringPiSetup( void )
 {
     char source[128];
     int i;
     Q_getwd(source);
-    for(i=0; i<14; i++)
+    for(i=0; i<SOFTGPIO_PINS; i++)
 
     {
         /*
@@ -53,7 +105,9 @@ void pinMode(int pin, int mode)
         pinmode[pin] = true;
     else if(mode == OUTPUT)
         pinmode[pin] = false;
-    SaveFile (filepath[pin],&default_value,sizeof(softgpio_t));
+    /* an input must not overwrite what the other side already drives */
+    if(mode == OUTPUT || FileTime(filepath[pin]) == -1)
+        SaveFile (filepath[pin],&default_value,sizeof(softgpio_t));
 }
 
 int digitalRead(int pin)
@@ -63,9 +117,13 @@ int digitalRead(int pin)
     {
         softgpio_t *buffer;
         int ret;
-        LoadFile (filepath[pin], (void **)&buffer);
+        /* the writer truncates before it writes, read again until the state is there */
+        while(LoadFile (filepath[pin], (void **)&buffer) < (int)sizeof(softgpio_t))
+            free(buffer);
         ret = buffer->state;
         free(buffer);
+        if(trace_on)
+            pinTraceRecord(pin, ret, 1);
         return ret;
     }
 
@@ -82,6 +140,8 @@ void digitalWrite(int pin, int value)
         softgpio_t buffer;
         buffer.state = (char)value;
         SaveFile (filepath[pin], &buffer,sizeof(softgpio_t));
+        if(trace_on)
+            pinTraceRecord(pin, value, 0);
     }
 
     else
@@ -104,11 +164,325 @@ void delayMicroseconds(unsigned int howLong)
 {
 
 #ifdef WIN32
+    LARGE_INTEGER freq, start, now;
 
+    if(howLong >= 1000)
+    {
+        Sleep(howLong / 1000);
+        return;
+    }
+    if(!howLong || !QueryPerformanceFrequency(&freq))
+        return;
+    QueryPerformanceCounter(&start);
+    do
+        QueryPerformanceCounter(&now);
+    while((now.QuadPart - start.QuadPart) * 1000000 / freq.QuadPart < howLong);
 #else
     usleep(howLong);
 #endif
 
 }
 
+unsigned int millis(void)
+{
+
+#ifdef WIN32
+    return GetTickCount();
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (unsigned int)(tv.tv_sec * 1000 + tv.tv_usec / 1000);
+#endif
+
+}
+
+unsigned int micros(void)
+{
+
+#ifdef WIN32
+    LARGE_INTEGER freq, now;
+
+    if(!QueryPerformanceFrequency(&freq))
+        return GetTickCount() * 1000;
+    QueryPerformanceCounter(&now);
+    return (unsigned int)(now.QuadPart / freq.QuadPart * 1000000 +
+                          now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (unsigned int)(tv.tv_sec * 1000000 + tv.tv_usec);
+#endif
+
+}
+
+static void pinTraceNow(unsigned int *sec, unsigned int *nsec)
+{
+
+#ifdef WIN32
+    LARGE_INTEGER freq, now;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    *sec = (unsigned int)(now.QuadPart / freq.QuadPart);
+    *nsec = (unsigned int)(now.QuadPart % freq.QuadPart * 1000000000 / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *sec = (unsigned int)ts.tv_sec;
+    *nsec = (unsigned int)ts.tv_nsec;
+#endif
+
+}
+
+/*
+============
+pinTraceBuffer
+
+  The calling thread's buffer, claims a free one the first time.
+  NULL once all SOFTGPIO_TRACE_THREADS are taken.
+============
+*/
+static trace_buffer_t *pinTraceBuffer(void)
+{
+    trace_buffer_t *b;
+    int i;
+#ifdef WIN32
+    DWORD self = GetCurrentThreadId();
+#else
+    pthread_t self = pthread_self();
+#endif
+
+    for(i=0; i<trace_numbuffers; i++)
+    {
+#ifdef WIN32
+        if(trace_buffers[i].owner == self)
+#else
+        if(pthread_equal(trace_buffers[i].owner, self))
+#endif
+            return &trace_buffers[i];
+    }
+
+    b = NULL;
+    ThreadLock();
+    if(trace_numbuffers < SOFTGPIO_TRACE_THREADS)
+    {
+        b = &trace_buffers[trace_numbuffers];
+        b->events = malloc(SOFTGPIO_TRACE_EVENTS * sizeof(trace_event_t));
+        if(b->events)
+        {
+            b->owner = self;
+            b->count = 0;
+            b->dropped = 0;
+            trace_numbuffers++;
+        }
+        else
+            b = NULL;
+    }
+    else
+        trace_overflow++;
+    ThreadUnlock();
+    return b;
+}
+
+static void pinTraceRecord(int pin, int value, int read)
+{
+    trace_buffer_t *b;
+    trace_event_t *e;
+    unsigned int sec, nsec;
+
+    b = pinTraceBuffer();
+    if(!b)
+        return;
+    if(b->count >= SOFTGPIO_TRACE_EVENTS)
+    {
+        b->dropped++;
+        return;
+    }
+
+    pinTraceNow(&sec, &nsec);
+    if(nsec < trace_start_nsec)
+    {
+        nsec += 1000000000;
+        sec--;
+    }
+    e = &b->events[b->count];
+    e->sec = sec - trace_start_sec;
+    e->nsec = nsec - trace_start_nsec;
+    e->pin = (short)pin;
+    e->value = (char)(value != LOW);
+    e->read = (char)read;
+    b->count++;
+}
+
+/*
+============
+pinTraceStart
+
+  Starts recording every digitalRead and digitalWrite, throwing away
+  whatever an earlier trace left. pinTraceStop writes the VCD file.
+============
+*/
+void pinTraceStart(char *vcdfile)
+{
+    int i;
+
+    trace_on = 0;
+    ThreadLock();
+    strncpy(trace_file, vcdfile, sizeof(trace_file) - 1);
+    trace_file[sizeof(trace_file) - 1] = 0;
+    for(i=0; i<trace_numbuffers; i++)
+    {
+        trace_buffers[i].count = 0;
+        trace_buffers[i].dropped = 0;
+    }
+    trace_overflow = 0;
+    pinTraceNow(&trace_start_sec, &trace_start_nsec);
+    ThreadUnlock();
+    trace_on = 1;
+}
+
+int pinTraceActive(void)
+{
+    return trace_on;
+}
+
+static int pinTraceCompare(const void *a, const void *b)
+{
+    const trace_event_t *ea = (const trace_event_t *)a;
+    const trace_event_t *eb = (const trace_event_t *)b;
+
+    if(ea->sec != eb->sec)
+        return ea->sec < eb->sec ? -1 : 1;
+    if(ea->nsec != eb->nsec)
+        return ea->nsec < eb->nsec ? -1 : 1;
+    return 0;
+}
+
+/* VCD identifier codes, printable ASCII '!' to '~' */
+static void pinTraceId(char *out, int n)
+{
+    do
+    {
+        *out++ = (char)('!' + n % 94);
+        n /= 94;
+    } while(n);
+    *out = 0;
+}
+
+/*
+============
+pinTraceStop
+
+  Stops recording and writes the trace. A written pin becomes wire
+  pinN, a read pin wire pinN_in with the value that was seen and event
+  pinN_read, which fires on every read, changed or not.
+  Returns the number of events written, or -1 on error.
+============
+*/
+int pinTraceStop(void)
+{
+    static char ids[SOFTGPIO_PINS][3][4];   /* write, read value, read event */
+    signed char last[SOFTGPIO_PINS][2];
+    byte used[SOFTGPIO_PINS];
+    trace_event_t *all;
+    trace_event_t *e;
+    FILE *f;
+    int total, dropped;
+    int counts[SOFTGPIO_TRACE_THREADS];
+    int numbuffers;
+    int i, n, pin;
+    double t, lastt;
+
+    if(!trace_on)
+        return -1;
+    trace_on = 0;
+
+    /* threads still inside pinTraceRecord only ever add behind count */
+    numbuffers = trace_numbuffers;
+    for(i=0, total=0, dropped=0; i<numbuffers; i++)
+    {
+        counts[i] = trace_buffers[i].count;
+        total += counts[i];
+        dropped += trace_buffers[i].dropped;
+    }
+
+    all = malloc((total ? total : 1) * sizeof(trace_event_t));
+    if(!all)
+        return -1;
+    for(i=0, n=0; i<numbuffers; i++)
+    {
+        memcpy(all + n, trace_buffers[i].events, counts[i] * sizeof(trace_event_t));
+        n += counts[i];
+    }
+    qsort(all, total, sizeof(trace_event_t), pinTraceCompare);
+
+    f = fopen(trace_file, "w");
+    if(!f)
+    {
+        free(all);
+        return -1;
+    }
+
+    memset(used, 0, sizeof(used));
+    for(i=0; i<total; i++)
+        used[all[i].pin] |= all[i].read ? 2 : 1;
+
+    fprintf(f, "$comment softgpio pin trace, %d events, %d dropped, %d threads without a buffer $end\n",
+            total, dropped, trace_overflow);
+    fprintf(f, "$timescale 1ns $end\n");
+    fprintf(f, "$scope module softgpio $end\n");
+    for(pin=0, n=0; pin<SOFTGPIO_PINS; pin++)
+    {
+        if(used[pin] & 1)
+        {
+            pinTraceId(ids[pin][0], n++);
+            fprintf(f, "$var wire 1 %s pin%d $end\n", ids[pin][0], pin);
+        }
+        if(used[pin] & 2)
+        {
+            pinTraceId(ids[pin][1], n++);
+            pinTraceId(ids[pin][2], n++);
+            fprintf(f, "$var wire 1 %s pin%d_in $end\n", ids[pin][1], pin);
+            fprintf(f, "$var event 1 %s pin%d_read $end\n", ids[pin][2], pin);
+        }
+    }
+    fprintf(f, "$upscope $end\n");
+    fprintf(f, "$enddefinitions $end\n");
+
+    fprintf(f, "#0\n$dumpvars\n");
+    for(pin=0; pin<SOFTGPIO_PINS; pin++)
+    {
+        last[pin][0] = last[pin][1] = -1;
+        if(used[pin] & 1)
+            fprintf(f, "x%s\n", ids[pin][0]);
+        if(used[pin] & 2)
+            fprintf(f, "x%s\n", ids[pin][1]);
+    }
+    fprintf(f, "$end\n");
+
+    for(i=0, lastt=0; i<total; i++)
+    {
+        e = &all[i];
+        t = e->sec * 1e9 + e->nsec;
+        if(t != lastt)
+        {
+            fprintf(f, "#%.0f\n", t);
+            lastt = t;
+        }
+        if(e->read)
+        {
+            if(last[e->pin][1] != e->value)
+                fprintf(f, "%d%s\n", e->value, ids[e->pin][1]);
+            fprintf(f, "1%s\n", ids[e->pin][2]);
+        }
+        else if(last[e->pin][0] != e->value)
+            fprintf(f, "%d%s\n", e->value, ids[e->pin][0]);
+        last[e->pin][e->read ? 1 : 0] = e->value;
+    }
+
+    fclose(f);
+    free(all);
+    return total;
+}
+
 #endif /* _SOFTGPIO */
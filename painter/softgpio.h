@@ -38,6 +38,11 @@ extern "C"
 #define	LOW			     0
 #define	HIGH			 1
 
+#define	SOFTGPIO_PINS	1280 /* MAX_LINKS * LINK_PINS, rounded up */
+
+#define	SOFTGPIO_TRACE_THREADS	64
+#define	SOFTGPIO_TRACE_EVENTS	0x40000 /* per thread, 3 MB */
+
 
 int wiringPiSetup( void );
 void pinMode(int pin, int mode);
@@ -49,6 +54,13 @@ void digitalWrite(int pin, int value);
 void delay(unsigned int howLong);
 void delayMicroseconds(unsigned int howLong);
 
+unsigned int millis(void);
+unsigned int micros(void);
+
+void pinTraceStart(char *vcdfile);
+int pinTraceActive(void);
+int pinTraceStop(void);
+
 
 #ifdef __cplusplus
     } //namespace softgpio
@@ -0,0 +1,237 @@
+/*
+
+===== timer.c ========================================================
+
+*/
+
+
+#include <stdio.h>
+
+#ifdef _SOFTGPIO
+#include "softgpio.h"
+#else
+#include <wiringPi.h>
+#endif
+
+#include "shared.h"
+#include "threads.h"
+
+
+/* list heads, a timer that isn't pending has next == NULL */
+static tm_timer_t tm_root[TM_ROOT_SIZE];
+static tm_timer_t tm_levels[TM_LEVELS][TM_LEVEL_SIZE];
+static tm_timer_t tm_expired;       /* being run by TM_run */
+static tm_timer_t *tm_running;      /* whose callback is running */
+static unsigned int tm_now;         /* next tick TM_run will look at */
+static int tm_initialized;
+
+
+static void TM_list_init(tm_timer_t *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static void TM_link(tm_timer_t *head, tm_timer_t *t)
+{
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void TM_unlink(tm_timer_t *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = NULL;
+    t->prev = NULL;
+}
+
+static void TM_setup(void)
+{
+    int i, j;
+
+    for(i=0; i<TM_ROOT_SIZE; i++)
+        TM_list_init(&tm_root[i]);
+    for(i=0; i<TM_LEVELS; i++)
+        for(j=0; j<TM_LEVEL_SIZE; j++)
+            TM_list_init(&tm_levels[i][j]);
+    TM_list_init(&tm_expired);
+    tm_now = millis();
+    tm_initialized = 1;
+}
+
+/*
+============
+TM_place
+
+  Puts a timer on the list of the wheel slot its expiry falls in.
+  Must hold ThreadLock.
+============
+*/
+static void TM_place(tm_timer_t *t)
+{
+    unsigned int delta = t->expires - tm_now;
+    int shift;
+    int level;
+
+    if((int)delta < 0)  /* already due */
+    {
+        TM_link(&tm_root[tm_now & (TM_ROOT_SIZE - 1)], t);
+        return;
+    }
+    if(delta < TM_ROOT_SIZE)
+    {
+        TM_link(&tm_root[t->expires & (TM_ROOT_SIZE - 1)], t);
+        return;
+    }
+    if(delta > TM_MAX_DELAY)
+        t->expires = tm_now + TM_MAX_DELAY;
+
+    for(level=0, shift=TM_ROOT_BITS; level<TM_LEVELS-1; level++, shift+=TM_LEVEL_BITS)
+        if(delta < 1u << (shift + TM_LEVEL_BITS))
+            break;
+    TM_link(&tm_levels[level][(t->expires >> shift) & (TM_LEVEL_SIZE - 1)], t);
+}
+
+/*
+============
+TM_cascade
+
+  Moves the timers of one outer slot to the wheels inside it,
+  returns the slot index so the caller knows when to go a level up
+============
+*/
+static int TM_cascade(int level)
+{
+    tm_timer_t *head;
+    tm_timer_t *t;
+    int index;
+
+    index = (tm_now >> (TM_ROOT_BITS + level * TM_LEVEL_BITS)) & (TM_LEVEL_SIZE - 1);
+    head = &tm_levels[level][index];
+    for(; head->next != head;)
+    {
+        t = head->next;
+        TM_unlink(t);
+        TM_place(t);
+    }
+    return index;
+}
+
+/*
+============
+TM_run
+
+  Runs the callbacks of all timers due by now
+============
+*/
+static void TM_run(void)
+{
+    unsigned int now = millis();
+    tm_timer_t *head;
+    tm_timer_t *t;
+    int level;
+
+    ThreadLock();
+    for(; (int)(now - tm_now) >= 0;)
+    {
+        if(!(tm_now & (TM_ROOT_SIZE - 1)))
+            for(level=0; level<TM_LEVELS && !TM_cascade(level); level++)
+                ;
+
+        head = &tm_root[tm_now & (TM_ROOT_SIZE - 1)];
+        if(head->next != head)  /* splice onto tm_expired */
+        {
+            head->next->prev = &tm_expired;
+            head->prev->next = &tm_expired;
+            tm_expired.next = head->next;
+            tm_expired.prev = head->prev;
+            TM_list_init(head);
+        }
+        tm_now++;
+
+        /* TM_cancel may take timers off tm_expired meanwhile */
+        for(; tm_expired.next != &tm_expired;)
+        {
+            t = tm_expired.next;
+            TM_unlink(t);
+            tm_running = t;
+            ThreadUnlock();
+            t->func(t->arg);
+            ThreadLock();
+            tm_running = NULL;
+        }
+    }
+    ThreadUnlock();
+}
+
+void TM_init(tm_timer_t *t, void (*func)(void *arg), void *arg)
+{
+    t->next = NULL;
+    t->prev = NULL;
+    t->expires = 0;
+    t->func = func;
+    t->arg = arg;
+}
+
+/*
+============
+TM_add
+
+  Arms a timer to run ms from now, re-arms it if it is pending
+============
+*/
+void TM_add(tm_timer_t *t, unsigned int ms)
+{
+    ThreadLock();
+    if(!tm_initialized)
+        TM_setup();
+    if(t->next)
+        TM_unlink(t);
+    t->expires = millis() + ms;
+    TM_place(t);
+    ThreadUnlock();
+}
+
+/*
+============
+TM_cancel
+
+  Disarms a timer. If its callback is running, waits for it to
+  return, so the caller may reuse or free what the callback touches.
+============
+*/
+void TM_cancel(tm_timer_t *t)
+{
+    ThreadLock();
+    if(t->next)
+        TM_unlink(t);
+    for(; tm_running == t;)
+    {
+        ThreadUnlock();
+        delay(1);
+        ThreadLock();
+    }
+    ThreadUnlock();
+}
+
+int TM_pending(tm_timer_t *t)
+{
+    return t->next != NULL;
+}
+
+void TM_main(void)
+{
+    ThreadLock();
+    if(!tm_initialized)
+        TM_setup();
+    ThreadUnlock();
+
+    for(;;)
+    {
+        TM_run();
+        delay(1);
+    }
+}
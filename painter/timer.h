@@ -0,0 +1,71 @@
+/*
+//=============================================================================
+//
+// Purpose: hierarchical timer wheel, one service thread for all links
+//
+// $NoKeywords: $
+//=============================================================================
+*/
+
+
+#ifndef __TIMER__
+#define __TIMER__
+
+
+/*
+// timer.h
+*/
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+   A tick is one millisecond. The root wheel holds the next 256 ticks,
+   each outer level 64 times the span of the one inside it, about 18
+   hours in all. Adding and cancelling a timer is a list insert or
+   unlink, and a timer is moved down a level at most once per level on
+   its way to expiring.
+
+   TM_main advances the wheels and runs the callbacks of expired timers
+   on its own thread, painter gives it a work item of its own. Callbacks
+   must not block, they hold up every other timer; they run without
+   ThreadLock, and may add or cancel other timers. A timer is one shot,
+   re-add it to repeat.
+
+   Once TM_cancel returns the timer's callback is neither pending nor
+   running, it waits for one in progress; a callback must therefore
+   not cancel its own timer.
+*/
+
+#define	TM_ROOT_BITS    8
+#define	TM_LEVEL_BITS   6
+#define	TM_LEVELS       3   /* outer levels */
+#define	TM_ROOT_SIZE    (1 << TM_ROOT_BITS)
+#define	TM_LEVEL_SIZE   (1 << TM_LEVEL_BITS)
+#define	TM_MAX_DELAY    ((1 << (TM_ROOT_BITS + TM_LEVELS * TM_LEVEL_BITS)) - 1)
+
+typedef struct tm_timer_s
+{
+    struct tm_timer_s *next;
+    struct tm_timer_s *prev;
+    unsigned int expires;   /* millis() */
+    void (*func)(void *arg);
+    void *arg;
+} tm_timer_t;
+
+void TM_init(tm_timer_t *t, void (*func)(void *arg), void *arg);
+void TM_add(tm_timer_t *t, unsigned int ms);
+void TM_cancel(tm_timer_t *t);
+int TM_pending(tm_timer_t *t);
+
+void TM_main(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /*__TIMER__*/
@@ -0,0 +1,260 @@
+/*
+
+===== tune.c ========================================================
+
+*/
+
+/*
+   Walks the serial bit period down while the link stays clean.
+   Every step retrains the peer (see SD_train and RC_train), sends
+   TN_PROBES packets of STROKE_OP_NOP records through the server and
+   counts resends and failures. The first step that costs more than
+   TN_MAX_ERRORS puts the link back to the last clean period.
+
+   TN_autotune instead goes through the loaded link profiles (see
+   profile.h) and keeps the one that delivers the most payload bytes
+   per second, which also weighs in the gap and the resend timeout.
+
+   The probes are ordinary data packets, so both ends need the rest of
+   the stack running; the calls block until the server has drained.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _SOFTGPIO
+#include "softgpio.h"
+#else
+#include <wiringPi.h>
+#endif
+
+#include "shared.h"
+#include "server.h"
+
+#include "tune.h"
+
+
+static void TN_wait_idle()
+{
+    for(; SV_queue_length() || !flag_server_ready || SD_queued(&link_default);)
+        delay(BAUD_RATE);
+}
+
+/*
+============
+TN_set_period
+
+  Switches both ends to a new bit period once the link is idle,
+  returns the new period
+============
+*/
+int TN_set_period(int period)
+{
+    if(period < TN_MIN_PERIOD)
+        period = TN_MIN_PERIOD;
+
+    TN_wait_idle();
+    SD_set_period(period);
+    for(; SD_period_pending();)
+        delay(BAUD_RATE);
+
+    return link_tx_period;
+}
+
+/*
+============
+TN_send_probes
+
+  Sends TN_PROBES packets at the current settings, up to sv_window of
+  them in flight as real traffic has it. Returns the resends and
+  failures they cost and the payload bytes per second that got
+  through, counting the probes only.
+============
+*/
+static void TN_send_probes(int *resends, int *failures, double *goodput)
+{
+    byte msg[MAX_MSG_LENGTH];
+    int tickets[TN_PROBES];
+    int sent;
+    unsigned int start;
+    unsigned int elapsed;
+    int state;
+    int i, j, done;
+
+    *resends = 0;
+    *failures = 0;
+    sent = 0;
+    start = millis();
+
+    for(i=0, done=0; done<TN_PROBES;)
+    {
+        if(i < TN_PROBES && i - done < link_default.sv_window)
+        {
+            /* |255|0|a|b| STROKE_OP_NOP records, see CmdLine.h */
+            for(j=0; j<MAX_MSG_LENGTH; j+=4)
+            {
+                msg[j] = 255;
+                msg[j+1] = 0;
+                msg[j+2] = (byte)(i * 37 + j);
+                msg[j+3] = (byte)~msg[j+2];
+            }
+
+            tickets[i] = SV_post_msg_lane(msg, MAX_MSG_LENGTH, SV_LANE_DATA);
+            if(tickets[i] == -1)
+                delay(BAUD_RATE);
+            else
+                i++;
+            continue;
+        }
+
+        state = SV_msg_state(tickets[done]);
+        if(state == SV_MSG_PENDING || state == SV_MSG_SENDING)
+        {
+            delay(link_tx_period);
+            continue;
+        }
+
+        if(state == SV_MSG_SENT)
+            sent++;
+        else
+            (*failures)++;
+        if(SV_msg_resends(tickets[done]) > 0)
+            *resends += SV_msg_resends(tickets[done]);
+        done++;
+    }
+
+    elapsed = millis() - start;
+    *goodput = sent * MAX_MSG_LENGTH * 1000.0 / (elapsed ? elapsed : 1);
+}
+
+/*
+============
+TN_probe
+
+  Returns the resends and failures TN_PROBES packets cost at period
+============
+*/
+static int TN_probe(int period)
+{
+    int resends, failures;
+    double goodput;
+
+    TN_set_period(period);
+    TN_send_probes(&resends, &failures, &goodput);
+    printf("Tune::%d ms: %d resends, %d failures in %d packets\n",
+           period, resends, failures, TN_PROBES);
+
+    return resends + failures;
+}
+
+/*
+============
+TN_tune
+
+  Returns the fastest clean bit period found, the link is left there.
+  Only LINK_SERIAL has a bit period to negotiate.
+============
+*/
+int TN_tune()
+{
+    int best;
+    int period;
+
+    if(link_mode != LINK_SERIAL)
+    {
+        printf("Tune::only serial links have a bit period to tune\n");
+        return link_tx_period;
+    }
+
+    best = link_tx_period;
+    if(TN_probe(best) > TN_MAX_ERRORS)
+    {
+        printf("Tune::link is not clean at %d ms, aborted!\n", best);
+        return best;
+    }
+
+    for(;;)
+    {
+        period = best * 3 / 4;
+        if(period == best)
+            period--;
+        if(period < TN_MIN_PERIOD || TN_probe(period) > TN_MAX_ERRORS)
+            break;
+        best = period;
+    }
+
+    TN_set_period(best);
+    printf("Tune::bit period is %d ms\n", best);
+    return best;
+}
+
+/*
+============
+TN_profile
+
+  Switches link_default to a profile once the link is idle, returns
+  -1 if that can't be done on a running link
+============
+*/
+int TN_profile(lp_profile_t *p)
+{
+    TN_wait_idle();
+    if(LP_apply(&link_default, p, 1))
+        return -1;
+    TN_set_period(p->period);
+    return 0;
+}
+
+/*
+============
+TN_autotune
+
+  Probes every loaded profile and leaves the link on the one with the
+  highest goodput. Returns that profile, NULL if none could be used,
+  and then the link is back on the settings it had.
+============
+*/
+lp_profile_t *TN_autotune()
+{
+    lp_profile_t before;
+    lp_profile_t *best = NULL;
+    lp_profile_t *p;
+    int resends, failures;
+    double goodput;
+    double best_goodput = 0;
+    int i;
+
+    strcpy(before.name, "(before)");
+    before.period = link_tx_period;
+    before.gap = link_default.gap;
+    before.ack_wait = link_default.ack_wait;
+    before.window = link_default.sv_window;
+    before.rc_buffer_size = link_default.rc_buffer_size;
+    before.msb = link_default.msb;
+
+    for(i=0; i<LP_count(); i++)
+    {
+        p = LP_get(i);
+        if(TN_profile(p))
+            continue;
+        TN_send_probes(&resends, &failures, &goodput);
+        printf("Tune::profile %s: %.1f bytes/s, %d resends, %d failures in %d packets\n",
+               p->name, goodput, resends, failures, TN_PROBES);
+        if(goodput > best_goodput)
+        {
+            best = p;
+            best_goodput = goodput;
+        }
+    }
+
+    if(!best)
+    {
+        printf("Tune::no profile got anything through, settings unchanged\n");
+        TN_profile(&before);
+        return NULL;
+    }
+
+    TN_profile(best);
+    printf("Tune::using profile %s\n", best->name);
+    return best;
+}
@@ -0,0 +1,44 @@
+/*
+//=============================================================================
+//
+// Purpose: serial link rate negotiation
+//
+// $NoKeywords: $
+//=============================================================================
+*/
+
+
+#ifndef __TUNE__
+#define __TUNE__
+
+
+/*
+// tune.h
+*/
+
+
+#ifndef __PROFILE__
+#include "profile.h"
+#endif  /*__PROFILE__*/
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define	TN_PROBES       8   /* probe packets per step */
+#define	TN_MAX_ERRORS   0   /* resends and failures a step may cost */
+#define	TN_MIN_PERIOD   1   /* ms */
+
+int TN_set_period(int period);
+int TN_tune();
+
+int TN_profile(lp_profile_t *p);
+lp_profile_t *TN_autotune();
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif  /*__TUNE__*/
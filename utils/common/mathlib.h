@@ -142,6 +142,255 @@ void UTIL_MoveBounds( const Vector &start, const Vector &mins, const Vector &max
 float RadiusFromBounds( const Vector &mins, const Vector &maxs );
 void PerpendicularVector( Vector &dst, const Vector &src );
 
+//
+// batch bounds operations, for culling and hit-testing thousands of
+// boxes in one pass. The boxes are kept one array per axis so 8 (AVX)
+// or 4 (SSE) of them are tested by each instruction, whatever the
+// compiler targets (-mavx, /arch:AVX, x64 always has SSE).
+//
+#if defined( __AVX__ )
+#include <immintrin.h>
+#define BOUNDS_LANES		8
+typedef __m256 boundsreg_t;
+#define BoundsLoad( p )		_mm256_loadu_ps( p )
+#define BoundsStore( p, a )	_mm256_storeu_ps( p, a )
+#define BoundsSet( f )		_mm256_set1_ps( f )
+#define BoundsMin( a, b )	_mm256_min_ps( a, b )
+#define BoundsMax( a, b )	_mm256_max_ps( a, b )
+#define BoundsAdd( a, b )	_mm256_add_ps( a, b )
+#define BoundsSub( a, b )	_mm256_sub_ps( a, b )
+#define BoundsMul( a, b )	_mm256_mul_ps( a, b )
+#define BoundsAnd( a, b )	_mm256_and_ps( a, b )
+#define BoundsOr( a, b )	_mm256_or_ps( a, b )
+#define BoundsGreater( a, b )	_mm256_cmp_ps( a, b, _CMP_GT_OQ )
+#define BoundsMask( a )		_mm256_movemask_ps( a )
+#elif defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+#include <xmmintrin.h>
+#define BOUNDS_LANES		4
+typedef __m128 boundsreg_t;
+#define BoundsLoad( p )		_mm_loadu_ps( p )
+#define BoundsStore( p, a )	_mm_storeu_ps( p, a )
+#define BoundsSet( f )		_mm_set1_ps( f )
+#define BoundsMin( a, b )	_mm_min_ps( a, b )
+#define BoundsMax( a, b )	_mm_max_ps( a, b )
+#define BoundsAdd( a, b )	_mm_add_ps( a, b )
+#define BoundsSub( a, b )	_mm_sub_ps( a, b )
+#define BoundsMul( a, b )	_mm_mul_ps( a, b )
+#define BoundsAnd( a, b )	_mm_and_ps( a, b )
+#define BoundsOr( a, b )	_mm_or_ps( a, b )
+#define BoundsGreater( a, b )	_mm_cmpgt_ps( a, b )
+#define BoundsMask( a )		_mm_movemask_ps( a )
+#else
+#define BOUNDS_LANES		1
+#endif
+
+// box i is mins[0..2][i] - maxs[0..2][i], the arrays are the caller's
+struct boundsarray_t
+{
+	float	*mins[3];
+	float	*maxs[3];
+	int	count;
+};
+
+inline void ClearBoundsArray( boundsarray_t &b )
+{
+	for( int j = 0; j < 3; j++ )
+	{
+		int i = 0;
+#if BOUNDS_LANES > 1
+		boundsreg_t lo = BoundsSet( 999999.0f ), hi = BoundsSet( -999999.0f );
+
+		for( ; i + BOUNDS_LANES <= b.count; i += BOUNDS_LANES )
+		{
+			BoundsStore( b.mins[j] + i, lo );
+			BoundsStore( b.maxs[j] + i, hi );
+		}
+#endif
+		for( ; i < b.count; i++ )
+		{
+			b.mins[j][i] = 999999.0f;
+			b.maxs[j][i] = -999999.0f;
+		}
+	}
+}
+
+// box i gets the bounds of points[first[i]] up to points[first[i+1]];
+// the runs differ in length, so this stays a scalar loop per box
+inline void CalcBoundsArray( boundsarray_t &b, const Vector *points, const int *first )
+{
+	for( int i = 0; i < b.count; i++ )
+	{
+		float mins[3] = { 999999.0f, 999999.0f, 999999.0f };
+		float maxs[3] = { -999999.0f, -999999.0f, -999999.0f };
+
+		for( int p = first[i]; p < first[i+1]; p++ )
+		{
+			const float *v = points[p];
+			for( int j = 0; j < 3; j++ )
+			{
+				mins[j] = v[j] < mins[j] ? v[j] : mins[j];	// minss/maxss, no branches
+				maxs[j] = v[j] > maxs[j] ? v[j] : maxs[j];
+			}
+		}
+		for( int j = 0; j < 3; j++ )
+		{
+			b.mins[j][i] = mins[j];
+			b.maxs[j][i] = maxs[j];
+		}
+	}
+}
+
+// sets result[i] to BoundsIntersect( box i, mins, maxs ), returns how many do
+inline int BoundsIntersectArray( const boundsarray_t &b, const Vector &mins, const Vector &maxs, byte *result )
+{
+	int i = 0, hits = 0;
+#if BOUNDS_LANES > 1
+	boundsreg_t lo[3], hi[3];
+
+	for( int j = 0; j < 3; j++ )
+	{
+		lo[j] = BoundsSet( mins[j] );
+		hi[j] = BoundsSet( maxs[j] );
+	}
+
+	for( ; i + BOUNDS_LANES <= b.count; i += BOUNDS_LANES )
+	{
+		boundsreg_t out = BoundsSet( 0.0f );
+
+		for( int j = 0; j < 3; j++ )
+		{
+			out = BoundsOr( out, BoundsGreater( BoundsLoad( b.mins[j] + i ), hi[j] ));
+			out = BoundsOr( out, BoundsGreater( lo[j], BoundsLoad( b.maxs[j] + i )));
+		}
+
+		int mask = ~BoundsMask( out );
+		for( int k = 0; k < BOUNDS_LANES; k++ )
+			hits += result[i+k] = ( mask >> k ) & 1;
+	}
+#endif
+	for( ; i < b.count; i++ )
+	{
+		result[i] = 1;
+		for( int j = 0; j < 3; j++ )
+		{
+			if( b.mins[j][i] > maxs[j] || mins[j] > b.maxs[j][i] )
+				result[i] = 0;
+		}
+		hits += result[i];
+	}
+
+	return hits;
+}
+
+inline int PointInBoundsArray( const boundsarray_t &b, const Vector &point, byte *result )
+{
+	return BoundsIntersectArray( b, point, point, result );
+}
+
+// CalcSqrDistanceToAABB for every box, 0 inside
+inline void CalcSqrDistanceToAABBArray( const boundsarray_t &b, const Vector &point, float *result )
+{
+	int i = 0;
+#if BOUNDS_LANES > 1
+	boundsreg_t p[3], zero = BoundsSet( 0.0f );
+
+	for( int j = 0; j < 3; j++ )
+		p[j] = BoundsSet( point[j] );
+
+	for( ; i + BOUNDS_LANES <= b.count; i += BOUNDS_LANES )
+	{
+		boundsreg_t dist = zero;
+
+		for( int j = 0; j < 3; j++ )
+		{
+			// at most one of the two is above zero
+			boundsreg_t d = BoundsAdd( BoundsMax( BoundsSub( BoundsLoad( b.mins[j] + i ), p[j] ), zero ),
+				BoundsMax( BoundsSub( p[j], BoundsLoad( b.maxs[j] + i )), zero ));
+			dist = BoundsAdd( dist, BoundsMul( d, d ));
+		}
+		BoundsStore( result + i, dist );
+	}
+#endif
+	for( ; i < b.count; i++ )
+	{
+		result[i] = 0.0f;
+		for( int j = 0; j < 3; j++ )
+		{
+			float d = 0.0f;
+			if( point[j] < b.mins[j][i] ) d = b.mins[j][i] - point[j];
+			else if( point[j] > b.maxs[j][i] ) d = point[j] - b.maxs[j][i];
+			result[i] += d * d;
+		}
+	}
+}
+
+// TransformAABB for every box, out may be b
+inline void TransformAABBArray( const matrix4x4 &world, const boundsarray_t &b, boundsarray_t &out )
+{
+	int i = 0;
+#if BOUNDS_LANES > 1
+	boundsreg_t m[4][3], a[3][3], half = BoundsSet( 0.5f );
+
+	for( int k = 0; k < 4; k++ )
+	{
+		for( int j = 0; j < 3; j++ )
+		{
+			m[k][j] = BoundsSet( world[k][j] );
+			if( k < 3 ) a[k][j] = BoundsSet( fabs( world[k][j] ));
+		}
+	}
+
+	for( ; i + BOUNDS_LANES <= b.count; i += BOUNDS_LANES )
+	{
+		boundsreg_t center[3], extent[3];
+
+		for( int k = 0; k < 3; k++ )
+		{
+			boundsreg_t lo = BoundsLoad( b.mins[k] + i );
+			boundsreg_t hi = BoundsLoad( b.maxs[k] + i );
+			center[k] = BoundsMul( BoundsAdd( lo, hi ), half );
+			extent[k] = BoundsMul( BoundsSub( hi, lo ), half );
+		}
+
+		for( int j = 0; j < 3; j++ )
+		{
+			boundsreg_t c = m[3][j], e = BoundsSet( 0.0f );
+
+			for( int k = 0; k < 3; k++ )
+			{
+				c = BoundsAdd( c, BoundsMul( center[k], m[k][j] ));
+				e = BoundsAdd( e, BoundsMul( extent[k], a[k][j] ));
+			}
+			BoundsStore( out.mins[j] + i, BoundsSub( c, e ));
+			BoundsStore( out.maxs[j] + i, BoundsAdd( c, e ));
+		}
+	}
+#endif
+	for( ; i < b.count; i++ )
+	{
+		float center[3], extent[3];
+
+		for( int k = 0; k < 3; k++ )
+		{
+			center[k] = ( b.mins[k][i] + b.maxs[k][i] ) * 0.5f;
+			extent[k] = ( b.maxs[k][i] - b.mins[k][i] ) * 0.5f;
+		}
+
+		for( int j = 0; j < 3; j++ )
+		{
+			float c = world[3][j], e = 0.0f;
+
+			for( int k = 0; k < 3; k++ )
+			{
+				c += center[k] * world[k][j];
+				e += extent[k] * fabs( world[k][j] );
+			}
+			out.mins[j][i] = c - e;
+			out.maxs[j][i] = c + e;
+		}
+	}
+}
+
 //
 // quaternion operations
 //
@@ -168,8 +168,17 @@ template < class T >
 class CUtlBlockVector : public CUtlArray< T, CUtlBlockMemory< T, int > >
 {
 public:
+	typedef CUtlBlockMemory< T, int > Memory_t;
+
 	CUtlBlockVector( int growSize = 0, int initSize = 0 )
 		: CUtlArray< T, CUtlBlockMemory< T, int > >( growSize, initSize ) {}
+
+	// func( T *pElements, int nCount ) once per block's worth of elements
+	template< class F > void ForEachChunk( F func )			{ this->m_Memory.ForEachChunk( 0, this->Count(), func ); }
+	template< class F > void ForEachChunk( F func ) const	{ this->m_Memory.ForEachChunk( 0, this->Count(), func ); }
+
+	typename Memory_t::ElementIterator_t IterateElements()				{ return this->m_Memory.IterateElements( 0, this->Count() ); }
+	typename Memory_t::ConstElementIterator_t IterateElements() const	{ return this->m_Memory.IterateElements( 0, this->Count() ); }
 };
 
 //-----------------------------------------------------------------------------
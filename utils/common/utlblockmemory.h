@@ -17,6 +17,15 @@
 #pragma warning (disable:4100)
 #pragma warning (disable:4514)
 
+#if defined( _MSC_VER ) && ( defined( _M_IX86 ) || defined( _M_X64 ))
+#include <xmmintrin.h>
+#define UTL_PREFETCH( p )	_mm_prefetch( (const char *)( p ), _MM_HINT_T0 )
+#elif defined( __GNUC__ )
+#define UTL_PREFETCH( p )	__builtin_prefetch( p )
+#else
+#define UTL_PREFETCH( p )
+#endif
+
 //-----------------------------------------------------------------------------
 // The CUtlBlockMemory class:
 // A growable memory class that allocates non-sequential blocks, but is indexed sequentially
@@ -52,6 +61,69 @@ public:
 	bool IsValidIterator( const Iterator_t &it ) const	{ return IsIdxValid( it.index ); }
 	Iterator_t InvalidIterator() const					{ return Iterator_t( InvalidIndex() ); }
 
+	// Walks elements by pointer instead of shifting and masking every index,
+	// and prefetches the next block on entering one, the hardware prefetcher
+	// only follows the block it's in
+	template< class E >
+	class ElementIteratorBase_t
+	{
+	public:
+		ElementIteratorBase_t( E *const *ppBlocks, int nFirst, int nCount, int nShift, int nMask )
+			: m_pElement( NULL ), m_pBlockEnd( NULL ), m_nLeft( nCount ), m_nBlockSize( nMask + 1 )
+		{
+			m_ppBlock = ppBlocks + ( nFirst >> nShift );
+			if ( nCount > 0 )
+				Enter( nFirst & nMask );
+		}
+
+		bool IsValid() const		{ return m_nLeft > 0; }
+		E& operator*() const		{ return *m_pElement; }
+		E* operator->() const		{ return m_pElement; }
+
+		ElementIteratorBase_t& operator++()
+		{
+			--m_nLeft;
+			if ( ++m_pElement == m_pBlockEnd && m_nLeft > 0 )
+			{
+				++m_ppBlock;
+				Enter( 0 );
+			}
+			return *this;
+		}
+
+	private:
+		void Enter( int nMinor )
+		{
+			m_pElement = *m_ppBlock + nMinor;
+			m_pBlockEnd = *m_ppBlock + m_nBlockSize;
+			if ( m_nLeft > m_pBlockEnd - m_pElement )
+				UTL_PREFETCH( m_ppBlock[1] );
+		}
+
+		E *m_pElement;
+		E *m_pBlockEnd;
+		E *const *m_ppBlock;
+		int m_nLeft;
+		int m_nBlockSize;
+	};
+	typedef ElementIteratorBase_t< T > ElementIterator_t;
+	typedef ElementIteratorBase_t< const T > ConstElementIterator_t;
+
+	ElementIterator_t IterateElements( int nFirst, int nCount )
+	{
+		return ElementIterator_t( m_pMemory, nFirst, nCount, m_nIndexShift, m_nIndexMask );
+	}
+	ConstElementIterator_t IterateElements( int nFirst, int nCount ) const
+	{
+		return ConstElementIterator_t( m_pMemory, nFirst, nCount, m_nIndexShift, m_nIndexMask );
+	}
+
+	// Calls func( T *pElements, int nCount ) for each contiguous run of the
+	// nCount elements from nFirst, in order, so the loop inside func is over
+	// plain memory
+	template< class F > void ForEachChunk( int nFirst, int nCount, F func );
+	template< class F > void ForEachChunk( int nFirst, int nCount, F func ) const;
+
 	// element access
 	T& operator[]( I i );
 	const T& operator[]( I i ) const;
@@ -188,6 +260,58 @@ inline const T& CUtlBlockMemory<T,I>::Element( I i ) const
 }
 
 
+//-----------------------------------------------------------------------------
+// chunk-wise access
+//-----------------------------------------------------------------------------
+template< class T, class I >
+template< class F >
+void CUtlBlockMemory<T,I>::ForEachChunk( int nFirst, int nCount, F func )
+{
+	assert( nCount <= 0 || ( IsIdxValid( nFirst ) && IsIdxValid( nFirst + nCount - 1 ) ) );
+
+	int nBlockSize = NumElementsInBlock();
+	while ( nCount > 0 )
+	{
+		int nMinor = MinorIndex( nFirst );
+		int n = nBlockSize - nMinor;
+		if ( n > nCount )
+			n = nCount;
+
+		T **ppBlock = m_pMemory + MajorIndex( nFirst );
+		if ( n < nCount )
+			UTL_PREFETCH( ppBlock[1] );
+		func( *ppBlock + nMinor, n );
+
+		nFirst += n;
+		nCount -= n;
+	}
+}
+
+template< class T, class I >
+template< class F >
+void CUtlBlockMemory<T,I>::ForEachChunk( int nFirst, int nCount, F func ) const
+{
+	assert( nCount <= 0 || ( IsIdxValid( nFirst ) && IsIdxValid( nFirst + nCount - 1 ) ) );
+
+	int nBlockSize = NumElementsInBlock();
+	while ( nCount > 0 )
+	{
+		int nMinor = MinorIndex( nFirst );
+		int n = nBlockSize - nMinor;
+		if ( n > nCount )
+			n = nCount;
+
+		const T *const *ppBlock = m_pMemory + MajorIndex( nFirst );
+		if ( n < nCount )
+			UTL_PREFETCH( ppBlock[1] );
+		func( *ppBlock + nMinor, n );
+
+		nFirst += n;
+		nCount -= n;
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Size
 //-----------------------------------------------------------------------------
@@ -75,6 +75,122 @@ inline float Q_rsqrt( float number )
 
 extern float HalfToFloat( unsigned short h );
 
+//=========================================================
+// batch half <-> float conversion. F16C does 8 per
+// instruction where the compiler targets it (-mf16c,
+// /arch:AVX2), otherwise tables built on first use.
+// Rounds to nearest even either way, NaNs stay NaNs.
+//=========================================================
+#if defined( __F16C__ ) || ( defined( _MSC_VER ) && defined( __AVX2__ ))
+#include <immintrin.h>
+#define HALF_F16C
+#endif
+
+struct halftables_t
+{
+	unsigned int	mantissa[2048];	// half -> float, by offset + mantissa
+	unsigned int	exponent[64];	// by sign and exponent
+	unsigned short	offset[64];
+	unsigned short	base[256];	// float -> half, by exponent
+	unsigned char	shift[256];
+	volatile bool	built;
+};
+
+inline const halftables_t &HalfTables( void )
+{
+	static halftables_t t;
+
+	if( t.built ) return t;
+
+	// racing builders write the same values, built is set last
+	t.mantissa[0] = 0;
+	for( int i = 1; i < 1024; i++ )
+	{
+		// denormals, normalize them
+		unsigned int m = i << 13, e = 0;
+		while(!( m & 0x00800000 )) { e -= 0x00800000; m <<= 1; }
+		t.mantissa[i] = ( m & ~0x00800000 ) | ( e + 0x38800000 );
+	}
+	for( int i = 1024; i < 2048; i++ )
+		t.mantissa[i] = 0x38000000 + (( i - 1024 ) << 13 );
+
+	for( int i = 0; i < 64; i++ )
+	{
+		int e = i & 31;
+		t.exponent[i] = ( i & 32 ) ? 0x80000000 : 0;
+		if( e == 31 ) t.exponent[i] |= 0x47800000;	// inf and NaN
+		else t.exponent[i] |= e << 23;
+		t.offset[i] = ( e == 0 ) ? 0 : 1024;
+	}
+
+	for( int i = 0; i < 256; i++ )
+	{
+		int e = i - 127;
+
+		if( e < -25 ) { t.base[i] = 0; t.shift[i] = 25; }	// rounds to zero
+		else if( e < -14 ) { t.base[i] = 0x0400 >> ( -e - 14 ); t.shift[i] = -e - 1; }	// denormal, or zero for -25
+		else if( e <= 15 ) { t.base[i] = ( e + 15 ) << 10; t.shift[i] = 13; }
+		else { t.base[i] = 0x7c00; t.shift[i] = 25; }	// overflow to inf
+	}
+
+	t.built = true;
+	return t;
+}
+
+inline void HalfToFloatArray( const unsigned short *in, float *out, int count )
+{
+	int i = 0;
+#ifdef HALF_F16C
+	for( ; i + 8 <= count; i += 8 )
+		_mm256_storeu_ps( out + i, _mm256_cvtph_ps( _mm_loadu_si128(( const __m128i *)( in + i ))));
+	if( i == count ) return;
+#endif
+	const halftables_t &t = HalfTables();
+
+	for( ; i < count; i++ )
+	{
+		unsigned int h = in[i];
+		unsigned int f = t.mantissa[t.offset[h >> 10] + ( h & 0x3ff )] + t.exponent[h >> 10];
+		if(( h & 0x7c00 ) == 0x7c00 && ( h & 0x3ff )) f |= 0x00400000;	// quiet NaN
+		out[i] = *(float *)&f;
+	}
+}
+
+inline void FloatToHalfArray( const float *in, unsigned short *out, int count )
+{
+	int i = 0;
+#ifdef HALF_F16C
+	for( ; i + 8 <= count; i += 8 )
+		_mm_storeu_si128(( __m128i *)( out + i ), _mm256_cvtps_ph( _mm256_loadu_ps( in + i ), 0 ));
+	if( i == count ) return;
+#endif
+	const halftables_t &t = HalfTables();
+
+	for( ; i < count; i++ )
+	{
+		unsigned int f = *(const unsigned int *)( in + i );
+		unsigned int e = ( f >> 23 ) & 0xff;
+		unsigned int m = f & 0x007fffff;
+		unsigned int h = ( f >> 16 ) & 0x8000;
+
+		if( e == 0xff )
+		{
+			// inf, or NaN with the top of its payload and the quiet bit
+			h |= 0x7c00 | ( m ? 0x0200 | ( m >> 13 ) : 0 );
+		}
+		else
+		{
+			int s = t.shift[e];
+			unsigned int sig = m | 0x00800000;	// the round and sticky bits
+
+			h += t.base[e] + ( m >> s );
+			if((( sig >> ( s - 1 )) & 1 ) && (( sig & (( 1u << ( s - 1 )) - 1 )) || ( h & 1 )))
+				h++;	// may carry into the exponent, up to inf
+		}
+		out[i] = h;
+	}
+}
+
 //=========================================================
 // 2DVector - used for many pathfinding and many other
 // operations that are treated as planar rather than 3d.
@@ -164,7 +280,7 @@ public:
 	inline Vector(const Vector& v)		{ x = v.x; y = v.y; z = v.z;		   }
 	inline Vector( const float *rgfl )		{ x = rgfl[0]; y = rgfl[1]; z = rgfl[2];   }
 	inline Vector(float rgfl[3])			{ x = rgfl[0]; y = rgfl[1]; z = rgfl[2];   }
-	inline Vector( const unsigned short rgus[3] )	{ x = HalfToFloat( rgus[0] ); y = HalfToFloat( rgus[1] ); z = HalfToFloat( rgus[2] ); }
+	inline Vector( const unsigned short rgus[3] )	{ HalfToFloatArray( rgus, &x, 3 ); }
 	inline Vector( char rgch[3] )
 	{
 		x = float( rgch[0] );
@@ -345,6 +461,25 @@ inline void VectorLerp( const Vector& src1, float t, const Vector& src2, Vector&
 	dest.z = src1.z + (src2.z - src1.z) * t;
 }
 
+//=========================================================
+// HalfVector - a Vector in 6 bytes, for geometry buffers
+// that can live with 11 bits of precision, about 3 digits
+//=========================================================
+class HalfVector
+{
+public:
+	inline HalfVector( void ) { }
+	inline HalfVector( const Vector &v ) { FloatToHalfArray( &v.x, &x, 3 ); }
+
+	operator Vector() const { return Vector( &x ); }
+
+	unsigned short x, y, z;
+};
+
+// whole arrays, Vector and HalfVector are plain float[3] and unsigned short[3]
+inline void VectorsToHalf( const Vector *in, HalfVector *out, int count ) { FloatToHalfArray( &in->x, &out->x, count * 3 ); }
+inline void HalfToVectors( const HalfVector *in, Vector *out, int count ) { HalfToFloatArray( &in->x, &out->x, count * 3 ); }
+
 //=========================================================
 // 4D Vector - for matrix operations
 //=========================================================